@@ -0,0 +1,613 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <argp.h>
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../src/mode/mode.h"
+#include "../src/pbo.h"
+
+/*
+ * Times the operations of the pbo tool on synthetic or given archives. Each
+ * operation runs several times and the fastest run is reported, so that
+ * page cache warmup and scheduling noise do not dominate.
+ */
+
+struct bench_archive {
+    char *path;
+    size_t entries;
+    off_t data_bytes, header_bytes;
+    char *pattern; // selects part of the archive for selective extraction
+    size_t selected;
+    off_t selected_bytes;
+};
+
+static struct bench_spec bench_spec = {
+    .entries = 10000,
+    .depth = 3,
+    .fanout = 8,
+    .dist = BENCH_DIST_EXP,
+    .size = 16384,
+    .property_count = 3,
+    .seed = 1,
+};
+
+static unsigned bench_runs = 3;
+static unsigned bench_uring_depth = 0; // also time extract and pack through io_uring
+static const char *bench_workdir = NULL;
+static struct mode_options bench_opts = {
+    .jobs = 1,
+};
+
+static const char **bench_inputs = NULL;
+static size_t bench_input_count = 0;
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_report(const char *name, double secs, size_t entries, off_t bytes) {
+    printf("%-20s %10.3f ms %14.0f entries/s %10.1f MB/s\n", name, secs * 1e3, entries / secs, bytes / secs / 1e6);
+}
+
+static int bench_remove_one(const char *path, const struct stat *info, int flag, struct FTW *ftw) {
+    (void) info, (void) flag, (void) ftw;
+    return remove(path) != 0 ? errno : 0;
+}
+
+static int bench_remove(const char *path) {
+    int status = nftw(path, bench_remove_one, 64, FTW_DEPTH | FTW_PHYS);
+    if(status < 0) {
+        return errno == ENOENT ? 0 : errno;
+    }
+    return status;
+}
+
+static int bench_fresh_dir(const char *path) {
+    int status = bench_remove(path);
+    if(status != 0) {
+        return status;
+    }
+    return mkdir(path, 00777) != 0 ? errno : 0;
+}
+
+// output of the list and verify modes is not what is being measured
+static int bench_quiet(bool quiet) {
+    static int saved = -1;
+
+    fflush(stdout);
+    if(quiet) {
+        int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if(null < 0) {
+            return errno;
+        }
+        saved = dup(STDOUT_FILENO);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    } else if(saved >= 0) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+        saved = -1;
+    }
+    return 0;
+}
+
+static int bench_load(const char *path, bool mapped, double *secs) {
+    int status;
+
+    PBO *pbo;
+    status = pbo_init(&pbo);
+    if(status != 0) {
+        return status;
+    }
+
+    FILE *file = fopen(path, "r");
+    if(file == NULL) {
+        status = errno;
+        pbo_destroy(pbo);
+        return status;
+    }
+
+    double start = bench_now();
+    status = mapped ? pbo_load_mmap(pbo, fileno(file)) : pbo_load(pbo, file);
+    *secs = bench_now() - start;
+
+    fclose(file);
+    pbo_destroy(pbo);
+    return status;
+}
+
+/*
+ * Reads the archive once to size it and to pick a selective extraction
+ * pattern: the leading directory of its middle entry, or that entry alone.
+ */
+static int bench_inspect(struct bench_archive *ar) {
+    int status;
+
+    PBO *pbo;
+    status = pbo_init(&pbo);
+    if(status != 0) {
+        return status;
+    }
+
+    FILE *file = fopen(ar->path, "r");
+    if(file == NULL) {
+        status = errno;
+        pbo_destroy(pbo);
+        return status;
+    }
+
+    status = pbo_load(pbo, file);
+    fclose(file);
+    if(status != 0) {
+        pbo_destroy(pbo);
+        return status;
+    }
+
+    ar->entries = pbo_get_entry_count(pbo);
+    ar->header_bytes = pbo_get_data_offset(pbo);
+    ar->data_bytes = 0;
+    for(size_t i = 0; i < ar->entries; i++) {
+        ar->data_bytes += pbo_entry_data_size(pbo_get_entry(pbo, i));
+    }
+
+    if(ar->entries > 0) {
+        const char *path = pbo_entry_path(pbo_get_entry(pbo, ar->entries / 2));
+        size_t len = strcspn(path, PBO_PATH_SEPARATOR "/");
+        ar->pattern = strndup(path, len);
+        if(ar->pattern == NULL) {
+            status = errno;
+        }
+    }
+
+    // the same matching as the extract mode, anchored at a whole component
+    for(size_t i = 0; i < ar->entries && status == 0; i++) {
+        PBO_ENTRY *ent = pbo_get_entry(pbo, i);
+        const char *path = pbo_entry_path(ent);
+        size_t len = strlen(ar->pattern);
+        if(strncasecmp(path, ar->pattern, len) == 0 && (path[len] == '\0' || path[len] == PBO_PATH_SEPARATOR[0] || path[len] == '/')) {
+            ar->selected++;
+            ar->selected_bytes += pbo_entry_data_size(ent);
+        }
+    }
+
+    pbo_destroy(pbo);
+    return status;
+}
+
+static int bench_extract(struct bench_archive *ar, const char *outdir, bool selective, double *secs) {
+    int status;
+
+    status = bench_fresh_dir(outdir);
+    if(status != 0) {
+        return status;
+    }
+
+    int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if(cwd < 0) {
+        return errno;
+    }
+    if(chdir(outdir) != 0) {
+        status = errno;
+        close(cwd);
+        return status;
+    }
+
+    const char *paths[] = { ar->path };
+    const char *patterns[] = { ar->pattern };
+    double start = bench_now();
+    status = pbo_mode_extract(paths, 1, patterns, selective ? 1 : 0, &bench_opts);
+    *secs = bench_now() - start;
+
+    if(fchdir(cwd) != 0 && status == 0) {
+        status = errno;
+    }
+    close(cwd);
+    return status;
+}
+
+static int bench_pack(const char *path, const char *dir, double *secs) {
+    unlink(path);
+
+    double start = bench_now();
+    int status = pbo_mode_pack(path, dir, &bench_opts);
+    *secs = bench_now() - start;
+    return status;
+}
+
+static int bench_uring(bool enable) {
+    int status = pbo_io_uring(enable ? bench_uring_depth : 0);
+    bench_opts.io_uring = status == 0 && enable ? bench_uring_depth : 0;
+    return status;
+}
+
+#define BENCH_BEST(best, call) do { \
+    (best) = INFINITY; \
+    for(unsigned run = 0; run < bench_runs; run++) { \
+        double secs; \
+        int run_status = (call); \
+        if(run_status != 0) { \
+            return run_status; \
+        } \
+        if(secs < (best)) { \
+            (best) = secs; \
+        } \
+    } \
+} while(0)
+
+/*
+ * Runs every operation against one archive. `tree` is the directory the
+ * archive was packed from, or NULL to pack what it extracts to instead.
+ */
+static int bench_archive(struct bench_archive *ar, const char *tree, const char *workdir) {
+    int status;
+
+    status = bench_inspect(ar);
+    if(status != 0) {
+        error(0, status, "failed to read %s", ar->path);
+        return status;
+    }
+
+    printf("%s: %zu entries, %jd bytes of data, %jd byte header\n", ar->path, ar->entries, (intmax_t) ar->data_bytes, (intmax_t) ar->header_bytes);
+
+    char outdir[PATH_MAX], packed[PATH_MAX];
+    if(snprintf(outdir, sizeof(outdir), "%s/out", workdir) >= (int) sizeof(outdir) || snprintf(packed, sizeof(packed), "%s/repacked.pbo", workdir) >= (int) sizeof(packed)) {
+        return ENAMETOOLONG;
+    }
+
+    double best;
+    BENCH_BEST(best, bench_load(ar->path, false, &secs));
+    bench_report("load", best, ar->entries, ar->header_bytes);
+    BENCH_BEST(best, bench_load(ar->path, true, &secs));
+    bench_report("load (mmap)", best, ar->entries, ar->header_bytes);
+
+    const char *paths[] = { ar->path };
+    status = bench_quiet(true);
+    if(status != 0) {
+        return status;
+    }
+    best = INFINITY;
+    for(unsigned run = 0; run < bench_runs && status == 0; run++) {
+        double start = bench_now();
+        status = pbo_mode_list(paths, 1, &bench_opts);
+        double secs = bench_now() - start;
+        best = secs < best ? secs : best;
+    }
+    bench_quiet(false);
+    if(status != 0) {
+        return status;
+    }
+    bench_report("list", best, ar->entries, ar->header_bytes);
+
+    BENCH_BEST(best, bench_extract(ar, outdir, false, &secs));
+    bench_report("extract", best, ar->entries, ar->data_bytes);
+    if(bench_uring_depth > 0) {
+        bench_uring(true);
+        BENCH_BEST(best, bench_extract(ar, outdir, false, &secs));
+        bench_uring(false);
+        bench_report("extract (io_uring)", best, ar->entries, ar->data_bytes);
+    }
+    if(ar->pattern != NULL) {
+        BENCH_BEST(best, bench_extract(ar, outdir, true, &secs));
+        bench_report("extract (selective)", best, ar->selected, ar->selected_bytes);
+    }
+
+    if(tree == NULL) {
+        // leave a full tree behind to pack
+        double secs;
+        status = bench_extract(ar, outdir, false, &secs);
+        if(status != 0) {
+            return status;
+        }
+        tree = outdir;
+    }
+    BENCH_BEST(best, bench_pack(packed, tree, &secs));
+    bench_report("pack", best, ar->entries, ar->data_bytes);
+    if(bench_uring_depth > 0) {
+        bench_uring(true);
+        BENCH_BEST(best, bench_pack(packed, tree, &secs));
+        bench_uring(false);
+        bench_report("pack (io_uring)", best, ar->entries, ar->data_bytes);
+    }
+
+    status = bench_quiet(true);
+    if(status != 0) {
+        return status;
+    }
+    best = INFINITY;
+    for(unsigned run = 0; run < bench_runs && status == 0; run++) {
+        double start = bench_now();
+        status = pbo_mode_verify(paths, 1, &bench_opts);
+        double secs = bench_now() - start;
+        best = secs < best ? secs : best;
+    }
+    bench_quiet(false);
+    // synthetic test archives do not all carry a trailer
+    if(status == 0) {
+        bench_report("verify", best, ar->entries, ar->header_bytes + ar->data_bytes);
+    }
+
+    bench_remove(outdir);
+    unlink(packed);
+    return 0;
+}
+
+static int bench_synthetic(const char *workdir) {
+    int status;
+
+    char tree[PATH_MAX], path[PATH_MAX];
+    if(snprintf(tree, sizeof(tree), "%s/tree", workdir) >= (int) sizeof(tree) || snprintf(path, sizeof(path), "%s/synthetic.pbo", workdir) >= (int) sizeof(path)) {
+        return ENAMETOOLONG;
+    }
+
+    status = bench_fresh_dir(tree);
+    if(status != 0) {
+        return status;
+    }
+
+    char **properties;
+    double start = bench_now();
+    status = bench_generate(&bench_spec, tree, &properties);
+    if(status != 0) {
+        error(0, status, "failed to generate %s", tree);
+        return status;
+    }
+    fprintf(stderr, "generated %zu entries in %.3f s\n", bench_spec.entries, bench_now() - start);
+
+    bench_opts.properties = (const char **) properties;
+    bench_opts.property_count = bench_spec.property_count;
+    status = pbo_mode_pack(path, tree, &bench_opts);
+    if(status != 0) {
+        error(0, status, "failed to pack %s", tree);
+    } else {
+        struct bench_archive ar = {
+            .path = path,
+        };
+        status = bench_archive(&ar, tree, workdir);
+        free(ar.pattern);
+    }
+
+    bench_opts.properties = NULL;
+    bench_opts.property_count = 0;
+    bench_properties_free(properties, bench_spec.property_count);
+
+    bench_remove(tree);
+    unlink(path);
+    return status;
+}
+
+static int bench_real(const char *input, const char *workdir) {
+    struct bench_archive ar = {
+        .path = realpath(input, NULL),
+    };
+    if(ar.path == NULL) {
+        int status = errno;
+        error(0, status, "failed to resolve %s", input);
+        return status;
+    }
+
+    int status = bench_archive(&ar, NULL, workdir);
+    free(ar.pattern);
+    free(ar.path);
+    return status;
+}
+
+/*
+ *
+ */
+
+static const struct argp_option args_opts[] = {
+    { NULL, 0, NULL, 0, "Synthetic archive:", 1 },
+    { "entries", 'n', "N", 0, "Number of entries (default 10000)", 0 },
+    { "depth", 'd', "N", 0, "Directories above each entry (default 3)", 0 },
+    { "fanout", 'F', "N", 0, "Subdirectories per directory (default 8)", 0 },
+    { "sizes", 's', "DIST", 0, "Entry sizes: fixed:N, uniform:MIN:MAX or exp:MEAN, with K or M suffixes (default exp:16K)", 0 },
+    { "properties", 'p', "N", 0, "Number of header properties (default 3)", 0 },
+    { "seed", 'r', "N", 0, "Generator seed (default 1)", 0 },
+
+    { NULL, 0, NULL, 0, "Benchmark options:", 2 },
+    { "runs", 'R', "N", 0, "Runs per operation, the fastest is reported (default 3)", 0 },
+    { "jobs", 'j', "N", 0, "Threads used by the operations", 0 },
+    { "compress", 'z', "LEVEL", OPTION_ARG_OPTIONAL, "Compress text entries when packing", 0 },
+    { "io-uring", 'U', "DEPTH", OPTION_ARG_OPTIONAL, "Also time extracting and packing through io_uring (default depth 64)", 0 },
+    { "workdir", 'w', "DIR", 0, "Directory for generated and extracted files (default: a new one in /tmp)", 0 },
+
+    { NULL, 0, NULL, 0, "General options:", -1 },
+    { 0 }
+};
+
+static unsigned long long args_number(struct argp_state *state, const char *arg, bool suffix) {
+    char *end;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if(suffix && (*end == 'K' || *end == 'k')) {
+        value <<= 10;
+        end++;
+    } else if(suffix && (*end == 'M' || *end == 'm')) {
+        value <<= 20;
+        end++;
+    }
+
+    if(*arg == '\0' || *end != '\0') {
+        argp_error(state, "invalid number '%s'", arg);
+    }
+    return value;
+}
+
+static void args_sizes(struct argp_state *state, char *arg) {
+    char *kind = strtok(arg, ":"), *first = strtok(NULL, ":"), *second = strtok(NULL, ":");
+    if(kind == NULL || first == NULL) {
+        argp_error(state, "invalid size distribution");
+    }
+
+    bench_spec.size = args_number(state, first, true);
+    if(strcmp(kind, "fixed") == 0 && second == NULL) {
+        bench_spec.dist = BENCH_DIST_FIXED;
+    } else if(strcmp(kind, "exp") == 0 && second == NULL) {
+        bench_spec.dist = BENCH_DIST_EXP;
+    } else if(strcmp(kind, "uniform") == 0 && second != NULL) {
+        bench_spec.dist = BENCH_DIST_UNIFORM;
+        bench_spec.size_max = args_number(state, second, true);
+        if(bench_spec.size_max < bench_spec.size) {
+            argp_error(state, "invalid size range");
+        }
+    } else {
+        argp_error(state, "invalid size distribution");
+    }
+}
+
+static int args_parse(int key, char *arg, struct argp_state *state) {
+    switch(key) {
+        case 'n':
+            bench_spec.entries = args_number(state, arg, true);
+            break;
+        case 'd':
+            bench_spec.depth = args_number(state, arg, false);
+            break;
+        case 'F':
+            bench_spec.fanout = args_number(state, arg, false);
+            if(bench_spec.fanout == 0) {
+                argp_error(state, "fanout must be at least 1");
+            }
+            break;
+        case 's':
+            args_sizes(state, arg);
+            break;
+        case 'p':
+            bench_spec.property_count = args_number(state, arg, false);
+            break;
+        case 'r':
+            bench_spec.seed = args_number(state, arg, false);
+            break;
+
+        case 'R':
+            bench_runs = args_number(state, arg, false);
+            if(bench_runs == 0) {
+                argp_error(state, "at least one run is needed");
+            }
+            break;
+        case 'j':
+            bench_opts.jobs = args_number(state, arg, false);
+            if(bench_opts.jobs == 0) {
+                argp_error(state, "invalid job count '%s'", arg);
+            }
+            break;
+        case 'z': {
+            unsigned long long level = arg != NULL ? args_number(state, arg, false) : 6;
+            if(level < 1 || level > 12) {
+                argp_error(state, "invalid compression level '%s'", arg);
+            }
+            bench_opts.compress = level;
+            break;
+        }
+        case 'U':
+            bench_uring_depth = arg != NULL ? args_number(state, arg, false) : 64;
+            if(bench_uring_depth == 0 || bench_uring_depth > 4096) {
+                argp_error(state, "invalid queue depth '%s'", arg);
+            }
+            if(bench_uring(true) != 0) {
+                argp_failure(state, 1, ENOSYS, "io_uring unavailable");
+            }
+            bench_uring(false);
+            break;
+        case 'w':
+            bench_workdir = arg;
+            break;
+
+        case ARGP_KEY_ARG: {
+            const char **inputs = realloc(bench_inputs, (bench_input_count + 1) * sizeof(const char *));
+            if(inputs == NULL) {
+                argp_failure(state, errno, errno, "failed to add argument");
+            }
+            inputs[bench_input_count++] = arg;
+            bench_inputs = inputs;
+            break;
+        }
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static const struct argp args_info = {
+    .options = args_opts,
+    .parser = args_parse,
+    .args_doc = "[PBO...]",
+    .doc = "Times loading, listing, extracting, packing and verifying a synthetic PBO, or the given PBOs instead",
+};
+
+int main(int argc, char **argv) {
+    int status;
+
+    status = argp_parse(&args_info, argc, argv, 0, NULL, NULL);
+    if(status != 0) {
+        return status;
+    }
+
+    char workdir[PATH_MAX];
+    if(bench_workdir != NULL) {
+        snprintf(workdir, sizeof(workdir), "%s", bench_workdir);
+        if(mkdir(workdir, 00777) != 0 && errno != EEXIST) {
+            error(1, errno, "failed to create %s", workdir);
+        }
+    } else {
+        snprintf(workdir, sizeof(workdir), "/tmp/pbo_bench.XXXXXX");
+        if(mkdtemp(workdir) == NULL) {
+            error(1, errno, "failed to create a work directory");
+        }
+    }
+
+    // extraction changes into directories below it
+    char *absolute = realpath(workdir, NULL);
+    if(absolute == NULL) {
+        error(1, errno, "failed to resolve %s", workdir);
+    }
+    snprintf(workdir, sizeof(workdir), "%s", absolute);
+    free(absolute);
+
+    if(bench_input_count == 0) {
+        status = bench_synthetic(workdir);
+    } else {
+        for(size_t i = 0; i < bench_input_count && status == 0; i++) {
+            status = bench_real(bench_inputs[i], workdir);
+        }
+    }
+
+    if(bench_workdir == NULL) {
+        bench_remove(workdir);
+    }
+    return status != 0 ? 1 : 0;
+}
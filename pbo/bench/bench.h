@@ -0,0 +1,49 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum bench_dist {
+    BENCH_DIST_FIXED,
+    BENCH_DIST_UNIFORM,
+    BENCH_DIST_EXP,
+};
+
+/*
+ * Shape of a synthetic PBO. The same spec and seed always generate the same
+ * tree, and so the same packed archive.
+ */
+struct bench_spec {
+    size_t entries;
+    unsigned depth; // directories above each file
+    unsigned fanout; // subdirectories per directory
+
+    enum bench_dist dist;
+    size_t size, size_max; // fixed size, uniform bounds or exponential mean
+
+    size_t property_count;
+    uint64_t seed;
+};
+
+/*
+ * Writes the files of the spec below `dir`, which must exist, and returns
+ * matching KEY=VALUE properties to pack them with.
+ */
+int bench_generate(const struct bench_spec *spec, const char *dir, char ***properties);
+void bench_properties_free(char **properties, size_t count);
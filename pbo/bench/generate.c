@@ -0,0 +1,211 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+// 2020-01-01, so packed timestamps do not depend on when the tree was made
+#define BENCH_MTIME 1577836800
+
+#define BENCH_SIZE_CAP (64 * 1024 * 1024)
+
+static const char *const bench_exts[] = { "txt", "sqf", "cpp", "paa", "p3d", "wss" };
+#define BENCH_TEXT_EXTS 3
+
+static const char *const bench_words[] = {
+    "class", "private", "params", "_this", "select", "if", "then", "else",
+    "forEach", "count", "true", "false", "getPos", "player", "vehicle", "=",
+    "{", "}", ";", "call", "spawn", "scope", "displayName", "model",
+};
+
+static uint64_t bench_next(uint64_t *state) {
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static size_t bench_size(const struct bench_spec *spec, uint64_t *rng) {
+    size_t size;
+    switch(spec->dist) {
+        case BENCH_DIST_UNIFORM:
+            size = spec->size + bench_next(rng) % (spec->size_max - spec->size + 1);
+            break;
+        case BENCH_DIST_EXP: {
+            double u = (bench_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+            size = (size_t) (-log1p(-u) * spec->size);
+            break;
+        }
+        default:
+            size = spec->size;
+            break;
+    }
+    return size < BENCH_SIZE_CAP ? size : BENCH_SIZE_CAP;
+}
+
+static void bench_fill(unsigned char *buf, size_t len, bool text, uint64_t *rng) {
+    if(!text) {
+        for(size_t i = 0; i < len; i += 8) {
+            uint64_t word = bench_next(rng);
+            memcpy(buf + i, &word, len - i < 8 ? len - i : 8);
+        }
+        return;
+    }
+
+    size_t pos = 0;
+    while(pos < len) {
+        const char *word = bench_words[bench_next(rng) % (sizeof(bench_words) / sizeof(*bench_words))];
+        size_t wlen = strlen(word);
+        for(size_t i = 0; i < wlen && pos < len; i++) {
+            buf[pos++] = word[i];
+        }
+        if(pos < len) {
+            buf[pos++] = bench_next(rng) % 8 == 0 ? '\n' : ' ';
+        }
+    }
+}
+
+static int bench_mkdirs(char *path) {
+    for(char *c = path; *c != '\0'; c++) {
+        if(*c != '/' || c == path) {
+            continue;
+        }
+
+        *c = '\0';
+        int status = mkdir(path, 00777) != 0 && errno != EEXIST ? errno : 0;
+        *c = '/';
+        if(status != 0) {
+            return status;
+        }
+    }
+    return 0;
+}
+
+static int bench_write(const char *path, const void *data, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 00666);
+    if(fd < 0) {
+        return errno;
+    }
+
+    for(size_t done = 0; done < len;) {
+        ssize_t wlen = write(fd, (const char *) data + done, len - done);
+        if(wlen < 0) {
+            int status = errno;
+            close(fd);
+            return status;
+        }
+        done += wlen;
+    }
+
+    struct timespec times[2] = {
+        { .tv_sec = BENCH_MTIME },
+        { .tv_sec = BENCH_MTIME },
+    };
+    if(futimens(fd, times) != 0) {
+        int status = errno;
+        close(fd);
+        return status;
+    }
+
+    return close(fd) != 0 ? errno : 0;
+}
+
+static int bench_generate_properties(const struct bench_spec *spec, char ***properties) {
+    char **props = calloc(spec->property_count > 0 ? spec->property_count : 1, sizeof(char *));
+    if(props == NULL) {
+        return errno;
+    }
+
+    for(size_t i = 0; i < spec->property_count; i++) {
+        int len = i == 0 ? asprintf(&props[i], "prefix=bench\\%llx", (unsigned long long) spec->seed) : asprintf(&props[i], "key%zu=value%zu", i, i);
+        if(len < 0) {
+            bench_properties_free(props, i);
+            return ENOMEM;
+        }
+    }
+
+    *properties = props;
+    return 0;
+}
+
+int bench_generate(const struct bench_spec *spec, const char *dir, char ***properties) {
+    int status;
+
+    uint64_t rng = spec->seed != 0 ? spec->seed : 1;
+    unsigned char *buf = NULL;
+    size_t bufcap = 0;
+
+    char path[PATH_MAX];
+    status = 0;
+    for(size_t i = 0; i < spec->entries && status == 0; i++) {
+        int len = snprintf(path, sizeof(path), "%s", dir);
+        for(unsigned d = 0; d < spec->depth; d++) {
+            len += snprintf(path + len, sizeof(path) - len, "/d%u", (unsigned) (bench_next(&rng) % spec->fanout));
+        }
+
+        size_t ext = bench_next(&rng) % (sizeof(bench_exts) / sizeof(*bench_exts));
+        len += snprintf(path + len, sizeof(path) - len, "/f%zu.%s", i, bench_exts[ext]);
+        if(len >= (int) sizeof(path)) {
+            status = ENAMETOOLONG;
+            break;
+        }
+
+        size_t size = bench_size(spec, &rng);
+        if(size > bufcap) {
+            unsigned char *grown = realloc(buf, size);
+            if(grown == NULL) {
+                status = errno;
+                break;
+            }
+            buf = grown;
+            bufcap = size;
+        }
+        bench_fill(buf, size, ext < BENCH_TEXT_EXTS, &rng);
+
+        status = bench_mkdirs(path);
+        if(status == 0) {
+            status = bench_write(path, buf, size);
+        }
+    }
+    free(buf);
+
+    if(status != 0) {
+        return status;
+    }
+    return bench_generate_properties(spec, properties);
+}
+
+void bench_properties_free(char **properties, size_t count) {
+    for(size_t i = 0; i < count; i++) {
+        free(properties[i]);
+    }
+    free(properties);
+}
@@ -15,6 +15,11 @@
  */
 
 #include <argp.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "mode/mode.h"
 #include "pbo.h"
@@ -23,23 +28,99 @@ static enum mode {
     MODE_NULL,
     MODE_LIST,
     MODE_EXTRACT,
+    MODE_CREATE,
+    MODE_VERIFY,
 } mode = MODE_NULL;
 
-static const char *pbo_file_path = NULL;
+enum {
+    OPT_MANIFEST = 0x100,
+    OPT_INDEX_CACHE,
+    OPT_IO_URING,
+    OPT_DROP_CACHE,
+    OPT_BUFFER_SIZE,
+    OPT_BWLIMIT,
+    OPT_ORDER,
+};
+
+static const char **pbo_files = NULL;
+static size_t pbo_file_count = 0;
+static const char *pbo_input_dir = NULL;
+
+static const char **pbo_args = NULL;
+static size_t pbo_arg_count = 0;
+
+static struct mode_options mode_opts = {
+    .jobs = 1,
+};
+
+static struct pbo_io_policy io_policy;
 
 static const struct argp_option args_opts[] = {
     { NULL, 0, NULL, 0, "Operating modes:", 1},
     { "list", 't', NULL, 0, "List contents of PBO", 0 },
     { "extract", 'x', NULL, 0, "Extract contents of PBO", 0 },
+    { "create", 'c', NULL, 0, "Create PBO from the contents of DIR", 0 },
+    { "verify", 'W', NULL, 0, "Check the SHA-1 trailer of PBOs and PBOs in directories", 0 },
 
     { NULL, 0, NULL, 0, "Common options:", 2},
-    { "file", 'f', "PBO", 0, "Specify PBO file", 0 },
+    { "file", 'f', "PBO", 0, "Specify PBO file, or - to extract from standard input. May be repeated, and directories are searched for PBOs, except when creating", 0 },
     { "pbo", 0, NULL, OPTION_ALIAS, NULL, 0 },
+    { "jobs", 'j', "N", 0, "Use N threads for extraction, compression, verification and reading the tree of created PBO", 0 },
+    { "io-uring", OPT_IO_URING, "DEPTH", OPTION_ARG_OPTIONAL, "Extract small files and read inputs of created PBO through io_uring, with up to DEPTH files in flight (default 64)", 0 },
+    { "drop-cache", OPT_DROP_CACHE, NULL, 0, "Drop archives and extracted files from the page cache once done with them, sparing the cache of other programs", 0 },
+    { "buffer-size", OPT_BUFFER_SIZE, "SIZE", 0, "Copy data in buffers of SIZE bytes, with an optional K, M or G suffix (default 1M)", 0 },
+    { "bwlimit", OPT_BWLIMIT, "RATE", 0, "Write at most RATE bytes per second across all threads, with an optional K, M or G suffix", 0 },
+    { "stats", 'S', "FORMAT", OPTION_ARG_OPTIONAL, "Print timings, I/O counts and the slowest entries to stderr, as human readable lines or json", 0 },
+    { "property", 'P', "KEY=VALUE", 0, "Add a header property to created PBO", 0 },
+    { "incremental", 'u', NULL, 0, "Only extract entries that differ from the files on disk, or update an existing PBO with only the files that changed", 0 },
+    { "manifest", OPT_MANIFEST, "FILE", 0, "Compare extracted files by content hashes kept in FILE (implies -u)", 0 },
+    { "long", 'l', "FORMAT", OPTION_ARG_OPTIONAL, "List the type, size, packed size, timestamp and data offset of each entry, as columns or json lines", 0 },
+    { "index-cache", OPT_INDEX_CACHE, "FILE", 0, "Keep parsed headers in FILE, so listing unchanged PBOs again does not read them", 0 },
+    { "compress", 'z', "LEVEL", OPTION_ARG_OPTIONAL, "Compress text entries of created PBO (LEVEL 1-12, default 6)", 0 },
+    { "order", OPT_ORDER, "ORDER", 0, "Order entries of created PBO by path, or by type or size and then path (default path)", 0 },
 
     { NULL, 0, NULL, 0, "General options:", -1 },
     { 0 }
 };
 
+static void args_add(struct argp_state *state, const char ***list, size_t *count, const char *arg) {
+    const char **args = realloc(*list, (*count + 1) * sizeof(const char *));
+    if(args == NULL) {
+        argp_failure(state, errno, errno, "failed to add argument");
+    }
+    args[(*count)++] = arg;
+    *list = args;
+}
+
+// a byte count with an optional binary K, M or G suffix
+static bool args_size(const char *arg, unsigned long long *size) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if(*arg == '\0' || *arg == '-' || errno != 0) {
+        return false;
+    }
+
+    unsigned shift = 0;
+    switch(*end) {
+        case 'K': case 'k': shift = 10; end++; break;
+        case 'M': case 'm': shift = 20; end++; break;
+        case 'G': case 'g': shift = 30; end++; break;
+    }
+    if(*end != '\0' || value > ULLONG_MAX >> shift) {
+        return false;
+    }
+
+    *size = value << shift;
+    return true;
+}
+
+static void args_policy(struct argp_state *state) {
+    if(pbo_io_policy(&io_policy) != 0) {
+        argp_error(state, "buffer size must be between 64K and 1G");
+    }
+}
+
 static int args_parse(int key, char *arg, struct argp_state *state) {
     int status;
 
@@ -56,13 +137,120 @@ static int args_parse(int key, char *arg, struct argp_state *state) {
             }
             mode = MODE_EXTRACT;
             break;
+        case 'c':
+            if(mode != MODE_NULL) {
+                argp_error(state, "mode already specified");
+            }
+            mode = MODE_CREATE;
+            break;
+        case 'W':
+            if(mode != MODE_NULL) {
+                argp_error(state, "mode already specified");
+            }
+            mode = MODE_VERIFY;
+            break;
 
         case 'f':
-            if(pbo_file_path != NULL) {
-                argp_error(state, "pbo file already specified");
+            args_add(state, &pbo_files, &pbo_file_count, arg);
+            break;
+        case 'j': {
+            char *end;
+            unsigned long jobs = strtoul(arg, &end, 10);
+            if(*arg == '\0' || *end != '\0' || jobs == 0 || jobs > UINT_MAX) {
+                argp_error(state, "invalid job count '%s'", arg);
+            }
+            mode_opts.jobs = jobs;
+            break;
+        }
+        case 'S':
+            if(arg != NULL && strcmp(arg, "json") == 0) {
+                mode_opts.stats_json = true;
+            } else if(arg != NULL && strcmp(arg, "human") != 0) {
+                argp_error(state, "invalid stats format '%s'", arg);
+            }
+            mode_opts.stats = true;
+            break;
+        case 'l':
+            if(arg != NULL && strcmp(arg, "json") == 0) {
+                mode_opts.list_json = true;
+            } else if(arg != NULL && strcmp(arg, "columns") != 0) {
+                argp_error(state, "invalid listing format '%s'", arg);
+            }
+            mode_opts.list_long = true;
+            break;
+        case 'u':
+            mode_opts.incremental = true;
+            break;
+        case OPT_MANIFEST:
+            mode_opts.manifest = arg;
+            mode_opts.incremental = true;
+            break;
+        case OPT_IO_URING: {
+            char *end = NULL;
+            unsigned long depth = arg != NULL ? strtoul(arg, &end, 10) : 64;
+            if(arg != NULL && (*arg == '\0' || *end != '\0' || depth == 0 || depth > 4096)) {
+                argp_error(state, "invalid queue depth '%s'", arg);
+            }
+
+            status = pbo_io_uring(depth);
+            if(status != 0) {
+                argp_failure(state, 0, status, "io_uring unavailable, using blocking I/O");
+                break;
+            }
+            mode_opts.io_uring = depth;
+            break;
+        }
+        case OPT_DROP_CACHE:
+            io_policy.drop_cache = true;
+            args_policy(state);
+            break;
+        case OPT_BUFFER_SIZE: {
+            unsigned long long size;
+            if(!args_size(arg, &size) || size > SIZE_MAX) {
+                argp_error(state, "invalid buffer size '%s'", arg);
+            }
+            io_policy.buffer_size = size;
+            args_policy(state);
+            break;
+        }
+        case OPT_BWLIMIT:
+            if(!args_size(arg, &io_policy.bandwidth)) {
+                argp_error(state, "invalid bandwidth '%s'", arg);
             }
-            pbo_file_path = arg;
+            args_policy(state);
+            break;
+        case OPT_INDEX_CACHE:
+            mode_opts.index_cache = arg;
             break;
+        case 'z': {
+            char *end = NULL;
+            long level = arg != NULL ? strtol(arg, &end, 10) : 6;
+            if(arg != NULL && (*arg == '\0' || *end != '\0' || level < 1 || level > 12)) {
+                argp_error(state, "invalid compression level '%s'", arg);
+            }
+            mode_opts.compress = level;
+            break;
+        }
+        case OPT_ORDER:
+            if(strcmp(arg, "path") == 0) {
+                mode_opts.order = MODE_ORDER_PATH;
+            } else if(strcmp(arg, "type") == 0) {
+                mode_opts.order = MODE_ORDER_TYPE;
+            } else if(strcmp(arg, "size") == 0) {
+                mode_opts.order = MODE_ORDER_SIZE;
+            } else {
+                argp_error(state, "invalid entry order '%s'", arg);
+            }
+            break;
+        case 'P': {
+            const char **properties = realloc(mode_opts.properties, (mode_opts.property_count + 1) * sizeof(const char *));
+            if(properties == NULL) {
+                argp_failure(state, errno, errno, "failed to add property");
+            }
+            properties[mode_opts.property_count++] = arg;
+            mode_opts.properties = properties;
+            break;
+        }
         
         case ARGP_KEY_ARG:
             switch(mode) {
@@ -71,9 +259,20 @@ static int args_parse(int key, char *arg, struct argp_state *state) {
                     break;
 
                 case MODE_LIST:
-                case MODE_EXTRACT:
                     argp_error(state, "extra arguments unused by this mode");
                     break;
+
+                case MODE_CREATE:
+                    if(pbo_input_dir != NULL) {
+                        argp_error(state, "extra arguments unused by this mode");
+                    }
+                    pbo_input_dir = arg;
+                    break;
+
+                case MODE_EXTRACT:
+                case MODE_VERIFY:
+                    args_add(state, &pbo_args, &pbo_arg_count, arg);
+                    break;
             }
 
             break;
@@ -84,24 +283,59 @@ static int args_parse(int key, char *arg, struct argp_state *state) {
                     break;
 
                 case MODE_LIST:
-                    if(pbo_file_path == NULL) {
+                    if(pbo_file_count == 0) {
                         argp_error(state, "pbo file not specified");
                     }
                 
-                    status = pbo_mode_list(pbo_file_path);
-                    if(status != 0) {
-                        argp_failure(state, status, status, "failed to list contents of %s", pbo_file_path);
+                    status = pbo_mode_list(pbo_files, pbo_file_count, &mode_opts);
+                    if(status != 0 && pbo_file_count == 1) {
+                        argp_failure(state, status, status, "failed to list contents of %s", pbo_files[0]);
+                    } else if(status != 0) {
+                        argp_failure(state, status, status, "listing failed");
                     }
                     break;
 
                 case MODE_EXTRACT:
-                    if(pbo_file_path == NULL) {
+                    if(pbo_file_count == 0) {
                         argp_error(state, "pbo file not specified");
                     }
                 
-                    status = pbo_mode_extract(pbo_file_path);
+                    status = pbo_mode_extract(pbo_files, pbo_file_count, pbo_args, pbo_arg_count, &mode_opts);
+                    if(status != 0 && pbo_file_count == 1) {
+                        argp_failure(state, status, status, "failed to extract contents of %s", pbo_files[0]);
+                    } else if(status != 0) {
+                        argp_failure(state, status, status, "extraction failed");
+                    }
+                    break;
+
+                case MODE_CREATE:
+                    if(pbo_file_count == 0) {
+                        argp_error(state, "pbo file not specified");
+                    }
+                    if(pbo_file_count > 1) {
+                        argp_error(state, "only one pbo file can be created at a time");
+                    }
+                    if(pbo_input_dir == NULL) {
+                        argp_error(state, "input directory not specified");
+                    }
+
+                    status = pbo_mode_pack(pbo_files[0], pbo_input_dir, &mode_opts);
+                    if(status != 0) {
+                        argp_failure(state, status, status, "failed to create %s", pbo_files[0]);
+                    }
+                    break;
+
+                case MODE_VERIFY:
+                    for(size_t i = 0; i < pbo_file_count; i++) {
+                        args_add(state, &pbo_args, &pbo_arg_count, pbo_files[i]);
+                    }
+                    if(pbo_arg_count == 0) {
+                        argp_error(state, "pbo file not specified");
+                    }
+
+                    status = pbo_mode_verify(pbo_args, pbo_arg_count, &mode_opts);
                     if(status != 0) {
-                        argp_failure(state, status, status, "failed to extract contents of %s", pbo_file_path);
+                        argp_failure(state, status, status, "verification failed");
                     }
                     break;
             }
@@ -14,53 +14,946 @@
  * limitations under the License.
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "inputs.h"
+#include "manifest.h"
 #include "mode.h"
+#include "plan.h"
+#include "stats.h"
 #include "../pbo.h"
+#include "../pool/pool.h"
+
+/*
+ * State of one archive of an extraction, from opening it to writing its
+ * manifest. Archives of a batch are extracted into their own directory.
+ */
+struct extract_archive {
+    const char *path;
+    char *root; // output directory, NULL to extract into the current one
+    int rootfd;
+
+    FILE *file;
+    PBO *pbo;
+    bool streaming;
+
+    PBO_ENTRY **entries;
+    size_t count, selected;
+    struct manifest manifest;
+    struct extract_plan plan;
+    bool planned;
+    int *results;
+    double *times; // per entry, when stats are kept
 
-int pbo_mode_extract(const char *path) {
     int status;
+};
+
+struct extract_job {
+    struct extract_archive *archive;
+    PBO_ENTRY *ent;
+    size_t index;
+};
+
+struct extract_ctx {
+    struct extract_job *jobs;
+    size_t count;
+};
+
+static void extract_worker(void *arg, size_t i) {
+    struct extract_ctx *ctx = arg;
+    struct extract_job *job = &ctx->jobs[i];
+    struct extract_archive *ar = job->archive;
+
+    if(ar->times == NULL) {
+        ar->results[job->index] = extract_plan_extract(&ar->plan, job->index, fileno(ar->file));
+        return;
+    }
+
+    double start = mode_stats_now();
+    ar->results[job->index] = extract_plan_extract(&ar->plan, job->index, fileno(ar->file));
+    ar->times[job->index] = mode_stats_now() - start;
+}
+
+// jobs handed to the library at once when batching through io_uring
+#define EXTRACT_BATCH 256
+
+/*
+ * Extracts a run of jobs with one call, so the library can batch their I/O.
+ * Each entry is charged an equal share of the time the run took.
+ */
+static void extract_batch_worker(void *arg, size_t i) {
+    struct extract_ctx *ctx = arg;
+    struct extract_job *jobs = ctx->jobs + i * EXTRACT_BATCH;
+    size_t count = ctx->count - i * EXTRACT_BATCH < EXTRACT_BATCH ? ctx->count - i * EXTRACT_BATCH : EXTRACT_BATCH;
+    double start = mode_stats_now();
+
+    struct pbo_extract_request requests[EXTRACT_BATCH];
+    struct extract_job *owners[EXTRACT_BATCH];
+    size_t queued = 0;
+    for(size_t j = 0; j < count; j++) {
+        struct extract_archive *ar = jobs[j].archive;
+
+        int dirfd;
+        const char *name;
+        int status = extract_plan_target(&ar->plan, jobs[j].index, &dirfd, &name);
+        if(status != 0) {
+            ar->results[jobs[j].index] = status;
+            continue;
+        }
+
+        requests[queued] = (struct pbo_extract_request) {
+            .ent = jobs[j].ent,
+            .pbofd = fileno(ar->file),
+            .dirfd = dirfd,
+            .name = name,
+        };
+        owners[queued++] = &jobs[j];
+    }
+
+    int status = pbo_entries_extract_at(requests, queued);
+    double share = (mode_stats_now() - start) / (count > 0 ? count : 1);
+
+    for(size_t j = 0; j < queued; j++) {
+        struct extract_archive *ar = owners[j]->archive;
+        ar->results[owners[j]->index] = status != 0 ? status : requests[j].status;
+    }
+    for(size_t j = 0; j < count; j++) {
+        if(jobs[j].archive->times != NULL) {
+            jobs[j].archive->times[jobs[j].index] = share;
+        }
+    }
+}
+
+static int extract_job_compare_path(const void *a, const void *b) {
+    const struct extract_job *ja = a, *jb = b;
+
+    if(ja->archive != jb->archive) {
+        return (ja->archive > jb->archive) - (ja->archive < jb->archive);
+    }
+
+    int cmp = strcmp(pbo_entry_path(ja->ent), pbo_entry_path(jb->ent));
+    if(cmp != 0) {
+        return cmp;
+    }
+    return (ja->index > jb->index) - (ja->index < jb->index);
+}
+
+static int extract_job_compare_size(const void *a, const void *b) {
+    const struct extract_job *ja = a, *jb = b;
+
+    off_t sa = pbo_entry_data_size(ja->ent), sb = pbo_entry_data_size(jb->ent);
+    if(sa != sb) {
+        return (sa < sb) - (sa > sb);
+    }
+    if(ja->archive != jb->archive) {
+        return (ja->archive > jb->archive) - (ja->archive < jb->archive);
+    }
+    return (ja->index > jb->index) - (ja->index < jb->index);
+}
+
+static void extract_report_entry(struct extract_archive *ar, PBO_ENTRY *ent, int status) {
+    if(ar->root != NULL) {
+        error(0, status, "failed to extract %s from %s", pbo_entry_path(ent), ar->path);
+    } else {
+        error(0, status, "failed to extract %s", pbo_entry_path(ent));
+    }
+}
 
-    struct pbo *pbo = NULL;
-    status = pbo_init(&pbo);
+/*
+ * Extracts the entries of every open archive on one pool. Jobs of all
+ * archives go into a single queue, so threads that run out of work in a small
+ * archive move on to the entries of a big one instead of idling.
+ */
+static int pbo_extract_parallel(struct extract_archive *archives, size_t archive_count, unsigned jobs, bool batched, bool timed) {
+    int status;
+
+    size_t count = 0;
+    for(size_t i = 0; i < archive_count; i++) {
+        struct extract_archive *ar = &archives[i];
+        if(ar->status != 0 || ar->streaming) {
+            continue;
+        }
+
+        ar->results = calloc(ar->plan.file_count > 0 ? ar->plan.file_count : 1, sizeof(int));
+        if(ar->results == NULL) {
+            return errno;
+        }
+        if(timed) {
+            ar->times = calloc(ar->plan.file_count > 0 ? ar->plan.file_count : 1, sizeof(double));
+            if(ar->times == NULL) {
+                return errno;
+            }
+        }
+        count += ar->plan.file_count;
+    }
+
+    struct extract_job *queue = calloc(count > 0 ? count : 1, sizeof(struct extract_job));
+    if(queue == NULL) {
+        return errno;
+    }
+
+    size_t queued = 0;
+    for(size_t i = 0; i < archive_count; i++) {
+        struct extract_archive *ar = &archives[i];
+        if(ar->status != 0 || ar->streaming) {
+            continue;
+        }
+
+        for(size_t j = 0; j < ar->plan.file_count; j++) {
+            queue[queued++] = (struct extract_job) {
+                .archive = ar,
+                .ent = ar->plan.files[j].ent,
+                .index = j,
+            };
+        }
+    }
+
+    // when a path occurs more than once only the last entry is written, as
+    // it would be when extracting serially
+    qsort(queue, count, sizeof(struct extract_job), extract_job_compare_path);
+    queued = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(i + 1 < count && queue[i].archive == queue[i + 1].archive && strcmp(pbo_entry_path(queue[i].ent), pbo_entry_path(queue[i + 1].ent)) == 0) {
+            continue;
+        }
+        queue[queued++] = queue[i];
+    }
+
+    // largest first, so a single big entry does not finish last on its own
+    qsort(queue, queued, sizeof(struct extract_job), extract_job_compare_size);
+
+    struct extract_ctx ctx = {
+        .jobs = queue,
+        .count = queued,
+    };
+
+    if(batched) {
+        status = pool_run(jobs, (queued + EXTRACT_BATCH - 1) / EXTRACT_BATCH, extract_batch_worker, &ctx);
+    } else {
+        status = pool_run(jobs, queued, extract_worker, &ctx);
+    }
+    free(queue);
     if(status != 0) {
         return status;
     }
 
-    FILE *file = fopen(path, "r");
-    if(file == NULL) {
+    for(size_t i = 0; i < archive_count; i++) {
+        struct extract_archive *ar = &archives[i];
+        if(ar->status != 0 || ar->streaming) {
+            continue;
+        }
+
+        for(size_t j = 0; j < ar->plan.file_count; j++) {
+            if(ar->results[j] != 0) {
+                extract_report_entry(ar, ar->plan.files[j].ent, ar->results[j]);
+                if(ar->status == 0) {
+                    ar->status = ar->results[j];
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int extract_path_normalize(char *buf, const char *path) {
+    size_t len = strlen(path);
+    if(len >= PATH_MAX) {
+        return ENAMETOOLONG;
+    }
+
+    for(size_t i = 0; i <= len; i++) {
+        buf[i] = path[i] == PBO_PATH_SEPARATOR[0] ? '/' : path[i];
+    }
+    return 0;
+}
+
+static int extract_entry_compare_offset(const void *a, const void *b) {
+    PBO_ENTRY *ea = *(PBO_ENTRY *const *) a, *eb = *(PBO_ENTRY *const *) b;
+
+    off_t oa = pbo_entry_offset(ea), ob = pbo_entry_offset(eb);
+    if(oa != ob) {
+        return (oa > ob) - (oa < ob);
+    }
+    return (ea > eb) - (ea < eb);
+}
+
+/*
+ * Collects the entries to extract, flagging the patterns that matched any.
+ * Selected entries are ordered by offset so that reading them sweeps the
+ * file forward once.
+ */
+static int extract_select(PBO *pbo, const char *const *patterns, size_t pattern_count, bool *matched, PBO_ENTRY ***selected, size_t *selected_count) {
+    int status;
+
+    size_t count = pbo_get_entry_count(pbo);
+    PBO_ENTRY **entries = malloc((count > 0 ? count : 1) * sizeof(PBO_ENTRY *));
+    if(entries == NULL) {
+        return errno;
+    }
+
+    if(pattern_count == 0) {
+        for(size_t i = 0; i < count; i++) {
+            entries[i] = pbo_get_entry(pbo, i);
+        }
+        *selected = entries;
+        *selected_count = count;
+        return 0;
+    }
+
+    char **globs = calloc(pattern_count, sizeof(char *));
+    if(globs == NULL) {
         status = errno;
-        pbo_destroy(pbo);
+        free(entries);
         return status;
     }
 
-    status = pbo_load(pbo, file);
+    status = 0;
+    for(size_t i = 0; i < pattern_count && status == 0; i++) {
+        globs[i] = malloc(PATH_MAX);
+        if(globs[i] == NULL) {
+            status = errno;
+        } else {
+            status = extract_path_normalize(globs[i], patterns[i]);
+        }
+    }
+
+    char path[PATH_MAX];
+    size_t used = 0;
+    for(size_t i = 0; i < count && status == 0; i++) {
+        PBO_ENTRY *ent = pbo_get_entry(pbo, i);
+        status = extract_path_normalize(path, pbo_entry_path(ent));
+        if(status != 0) {
+            break;
+        }
+
+        bool match = false;
+        for(size_t j = 0; j < pattern_count; j++) {
+            if(fnmatch(globs[j], path, FNM_NOESCAPE | FNM_CASEFOLD | FNM_LEADING_DIR) == 0) {
+                matched[j] = true;
+                match = true;
+            }
+        }
+
+        if(match) {
+            entries[used++] = ent;
+        }
+    }
+
+    for(size_t i = 0; i < pattern_count; i++) {
+        free(globs[i]);
+    }
+    free(globs);
+
     if(status != 0) {
-        fclose(file);
-        pbo_destroy(pbo);
+        free(entries);
         return status;
     }
 
-    for(PBO_ENTRY *ent = pbo_get_entries(pbo); ent != NULL; ent = pbo_entry_next(ent)) {
-        status = pbo_entry_extract(ent, file);
+    qsort(entries, used, sizeof(PBO_ENTRY *), extract_entry_compare_offset);
+
+    *selected = entries;
+    *selected_count = used;
+    return 0;
+}
+
+static int extract_stream_skip(FILE *file, off_t len) {
+    char buf[4096];
+    while(len > 0) {
+        size_t rlen = fread(buf, 1, len < (off_t) sizeof(buf) ? (size_t) len : sizeof(buf), file);
+        if(rlen == 0) {
+            return EIO;
+        }
+        len -= rlen;
+    }
+    return 0;
+}
+
+/*
+ * Extracts from input that cannot seek, such as a pipe, in one forward pass.
+ * The plan must be in offset order. Entries whose data overlaps what was
+ * already read cannot be served and are refused before anything is written.
+ */
+static int pbo_extract_stream(struct extract_plan *plan, FILE *file, off_t datapos, double *times) {
+    int status;
+
+    off_t pos = datapos;
+    for(size_t i = 0; i < plan->file_count; i++) {
+        PBO_ENTRY *ent = plan->files[i].ent;
+        if(pbo_entry_offset(ent) < pos) {
+            error(0, 0, "%s: data overlaps an earlier entry, extract from a seekable file instead", pbo_entry_path(ent));
+            return ESPIPE;
+        }
+        pos = pbo_entry_offset(ent) + pbo_entry_data_size(ent);
+    }
+
+    pos = datapos;
+    for(size_t i = 0; i < plan->file_count; i++) {
+        PBO_ENTRY *ent = plan->files[i].ent;
+
+        status = extract_stream_skip(file, pbo_entry_offset(ent) - pos);
+        if(status != 0) {
+            return status;
+        }
+
+        double start = times != NULL ? mode_stats_now() : 0;
+        status = extract_plan_extract_stream(plan, i, file);
+        if(times != NULL) {
+            times[i] = mode_stats_now() - start;
+        }
         if(status != 0) {
-            fclose(file);
-            pbo_destroy(pbo);
+            error(0, status, "failed to extract %s", pbo_entry_path(ent));
             return status;
         }
+        pos = pbo_entry_offset(ent) + pbo_entry_data_size(ent);
     }
 
-    if(fclose(file) != 0) {
-        status = errno;
-        pbo_destroy(pbo);
+    return 0;
+}
+
+static bool extract_is_current(PBO_ENTRY *ent, int pbofd, int rootfd, const struct manifest *manifest) {
+    char path[PATH_MAX];
+    if(extract_path_normalize(path, pbo_entry_path(ent)) != 0) {
+        return false;
+    }
+
+    struct stat info;
+    pbo_count(PBO_COUNTER_STAT, 1);
+    if(fstatat(rootfd, path, &info, 0) != 0 || !S_ISREG(info.st_mode) || info.st_size != pbo_entry_original_size(ent)) {
+        return false;
+    }
+
+    const struct manifest_record *record = manifest != NULL ? manifest_find(manifest, path) : NULL;
+    if(record != NULL) {
+        if(record->size != info.st_size || record->mtime.tv_sec != info.st_mtim.tv_sec || record->mtime.tv_nsec != info.st_mtim.tv_nsec) {
+            return false; // modified since it was extracted
+        }
+
+        unsigned char digest[PBO_DIGEST_SIZE];
+        return pbo_entry_hash(ent, pbofd, digest) == 0 && memcmp(digest, record->digest, PBO_DIGEST_SIZE) == 0;
+    }
+
+    return pbo_entry_timestamp(ent) != 0 && info.st_mtim.tv_sec == pbo_entry_timestamp(ent);
+}
+
+struct extract_check_ctx {
+    PBO_ENTRY **entries;
+    bool *current;
+    int pbofd, rootfd;
+    const struct manifest *manifest;
+};
+
+static void extract_check_worker(void *arg, size_t i) {
+    struct extract_check_ctx *ctx = arg;
+    ctx->current[i] = extract_is_current(ctx->entries[i], ctx->pbofd, ctx->rootfd, ctx->manifest);
+}
+
+/*
+ * Drops entries whose file on disk is already up to date. Without a manifest
+ * record, a file is current when its size and mtime match the entry; with
+ * one, when the entry data still hashes to what the file was written from.
+ */
+static int extract_skip_current(PBO_ENTRY **entries, size_t *count, int pbofd, int rootfd, const struct manifest *manifest, unsigned jobs) {
+    int status;
+
+    bool *current = calloc(*count > 0 ? *count : 1, sizeof(bool));
+    if(current == NULL) {
+        return errno;
+    }
+
+    struct extract_check_ctx ctx = {
+        .entries = entries,
+        .current = current,
+        .pbofd = pbofd,
+        .rootfd = rootfd,
+        .manifest = manifest,
+    };
+    status = pool_run(jobs, *count, extract_check_worker, &ctx);
+    if(status != 0) {
+        free(current);
+        return status;
+    }
+
+    size_t kept = 0;
+    for(size_t i = 0; i < *count; i++) {
+        if(!current[i]) {
+            entries[kept++] = entries[i];
+        }
+    }
+    *count = kept;
+
+    free(current);
+    return 0;
+}
+
+struct extract_record {
+    unsigned char digest[PBO_DIGEST_SIZE];
+    struct stat info;
+    int status;
+};
+
+struct extract_record_ctx {
+    PBO_ENTRY **entries;
+    struct extract_record *records;
+    int pbofd, rootfd;
+};
+
+static void extract_record_worker(void *arg, size_t i) {
+    struct extract_record_ctx *ctx = arg;
+    struct extract_record *record = &ctx->records[i];
+
+    char path[PATH_MAX];
+    record->status = extract_path_normalize(path, pbo_entry_path(ctx->entries[i]));
+    if(record->status != 0) {
+        return;
+    }
+
+    record->status = pbo_entry_hash(ctx->entries[i], ctx->pbofd, record->digest);
+    pbo_count(PBO_COUNTER_STAT, 1);
+    if(record->status == 0 && fstatat(ctx->rootfd, path, &record->info, 0) != 0) {
+        record->status = errno;
+    }
+}
+
+static int extract_update_manifest(struct manifest *manifest, const char *manifest_path, PBO_ENTRY **entries, size_t count, int pbofd, int rootfd, unsigned jobs) {
+    int status;
+
+    struct extract_record *records = calloc(count > 0 ? count : 1, sizeof(struct extract_record));
+    if(records == NULL) {
+        return errno;
+    }
+
+    struct extract_record_ctx ctx = {
+        .entries = entries,
+        .records = records,
+        .pbofd = pbofd,
+        .rootfd = rootfd,
+    };
+    status = pool_run(jobs, count, extract_record_worker, &ctx);
+
+    char path[PATH_MAX];
+    for(size_t i = 0; i < count && status == 0; i++) {
+        status = records[i].status;
+        if(status == 0) {
+            status = extract_path_normalize(path, pbo_entry_path(entries[i]));
+        }
+        if(status == 0) {
+            status = manifest_set(manifest, path, records[i].digest, &records[i].info);
+        }
+    }
+    free(records);
+
+    if(status != 0) {
         return status;
     }
+    return manifest_save(manifest, manifest_path);
+}
+
+static int extract_mkdirs(char *path) {
+    for(char *c = path;; c++) {
+        if(*c != '/' && *c != '\0') {
+            continue;
+        }
+
+        char end = *c;
+        *c = '\0';
+        pbo_count(PBO_COUNTER_MKDIR, c > path);
+        int status = c > path && mkdir(path, 00777) != 0 && errno != EEXIST ? errno : 0;
+        *c = end;
 
-    status = pbo_destroy(pbo);
+        if(status != 0 || end == '\0') {
+            return status;
+        }
+    }
+}
+
+static int extract_archive_open(struct extract_archive *ar, const char *const *patterns, size_t pattern_count, bool *matched, size_t *budget, const struct mode_options *opts, struct mode_stats *stats) {
+    int status;
+
+    mode_stats_phase(stats, "load");
+    status = pbo_init(&ar->pbo);
     if(status != 0) {
         return status;
     }
 
+    pbo_count(PBO_COUNTER_OPEN, 1);
+    ar->file = strcmp(ar->path, "-") == 0 ? stdin : fopen(ar->path, "r");
+    if(ar->file == NULL) {
+        return errno;
+    }
+
+    pbo_count(PBO_COUNTER_SEEK, 1);
+    ar->streaming = lseek(fileno(ar->file), 0, SEEK_CUR) < 0 && errno == ESPIPE;
+    if(ar->streaming && ar->root != NULL) {
+        return ESPIPE;
+    }
+
+    status = pbo_load(ar->pbo, ar->file);
+    if(status != 0) {
+        return status;
+    }
+
+    mode_stats_phase(stats, "select");
+    status = extract_select(ar->pbo, patterns, pattern_count, matched, &ar->entries, &ar->count);
+    if(status != 0) {
+        return status;
+    }
+    ar->selected = ar->count;
+
+    if(ar->streaming) {
+        qsort(ar->entries, ar->count, sizeof(PBO_ENTRY *), extract_entry_compare_offset);
+    }
+
+    if(opts->manifest != NULL) {
+        if(ar->streaming) {
+            error(0, 0, "a manifest needs seekable input to hash entries");
+            return ESPIPE;
+        }
+
+        status = manifest_load(&ar->manifest, opts->manifest);
+        if(status != 0) {
+            return status;
+        }
+    }
+
+    if(ar->root != NULL) {
+        mode_stats_phase(stats, "plan");
+        status = extract_mkdirs(ar->root);
+        if(status != 0) {
+            return status;
+        }
+
+        pbo_count(PBO_COUNTER_OPEN, 1);
+        ar->rootfd = open(ar->root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if(ar->rootfd < 0) {
+            return errno;
+        }
+    }
+
+    if(opts->incremental) {
+        mode_stats_phase(stats, "check");
+        status = extract_skip_current(ar->entries, &ar->count, fileno(ar->file), ar->rootfd, opts->manifest != NULL ? &ar->manifest : NULL, opts->jobs);
+        if(status != 0) {
+            return status;
+        }
+    }
+
+    mode_stats_phase(stats, "plan");
+    status = extract_plan_init(&ar->plan, ar->entries, ar->count, ar->rootfd);
+    if(status != 0) {
+        return status;
+    }
+    ar->planned = true;
+
+    return extract_plan_prepare(&ar->plan, budget);
+}
+
+static int extract_archive_serial(struct extract_archive *ar, bool timed) {
+    int status;
+
+    if(timed) {
+        ar->times = calloc(ar->plan.file_count > 0 ? ar->plan.file_count : 1, sizeof(double));
+        if(ar->times == NULL) {
+            return errno;
+        }
+    }
+
+    if(ar->streaming) {
+        return pbo_extract_stream(&ar->plan, ar->file, pbo_get_data_offset(ar->pbo), ar->times);
+    }
+
+    for(size_t i = 0; i < ar->plan.file_count; i++) {
+        double start = timed ? mode_stats_now() : 0;
+        status = extract_plan_extract(&ar->plan, i, fileno(ar->file));
+        if(timed) {
+            ar->times[i] = mode_stats_now() - start;
+        }
+        if(status != 0) {
+            return status;
+        }
+    }
     return 0;
 }
+
+static int extract_archive_finish(struct extract_archive *ar, const struct mode_options *opts) {
+    int status;
+
+    if(opts->manifest != NULL) {
+        status = extract_update_manifest(&ar->manifest, opts->manifest, ar->entries, ar->count, fileno(ar->file), ar->rootfd, opts->jobs);
+        if(status != 0) {
+            return status;
+        }
+    }
+
+    FILE *file = ar->file;
+    ar->file = NULL;
+    pbo_io_release(fileno(file));
+    if(fclose(file) != 0) {
+        return errno;
+    }
+    return 0;
+}
+
+static void extract_archive_destroy(struct extract_archive *ar) {
+    if(ar->planned) {
+        extract_plan_destroy(&ar->plan);
+    }
+    manifest_destroy(&ar->manifest);
+    free(ar->results);
+    free(ar->times);
+    free(ar->entries);
+
+    if(ar->rootfd >= 0) {
+        close(ar->rootfd);
+    }
+    if(ar->file != NULL) {
+        fclose(ar->file);
+    }
+    if(ar->pbo != NULL) {
+        pbo_destroy(ar->pbo);
+    }
+    free(ar->root);
+}
+
+struct extract_stats {
+    size_t archives, failed;
+    size_t dirs;
+    unsigned long dirs_created, syscalls, naive_syscalls;
+    size_t extracted, total, skipped;
+    off_t bytes;
+};
+
+static void extract_stats_add(struct extract_stats *stats, struct extract_archive *ar, struct mode_stats *mstats) {
+    stats->archives++;
+    if(ar->status != 0) {
+        stats->failed++;
+    }
+    if(!ar->planned) {
+        return;
+    }
+
+    stats->dirs += ar->plan.dir_count;
+    stats->dirs_created += ar->plan.stats.dirs_created;
+    // one open per extracted file on top of the directory setup
+    stats->syscalls += ar->plan.stats.syscalls + ar->plan.file_count;
+    stats->naive_syscalls += ar->plan.stats.naive_syscalls;
+
+    stats->extracted += ar->count;
+    stats->total += pbo_get_entry_count(ar->pbo);
+    stats->skipped += ar->selected - ar->count;
+    for(size_t i = 0; i < ar->count; i++) {
+        stats->bytes += pbo_entry_data_size(ar->entries[i]);
+    }
+
+    for(size_t i = 0; ar->times != NULL && i < ar->plan.file_count; i++) {
+        mode_stats_entry(mstats, pbo_entry_path(ar->plan.files[i].ent), ar->times[i]);
+    }
+}
+
+static int extract_root_compare(const void *a, const void *b) {
+    const struct extract_archive *aa = *(const struct extract_archive *const *) a, *ab = *(const struct extract_archive *const *) b;
+    return strcmp(aa->root, ab->root);
+}
+
+/*
+ * Names the output directory of each archive of a batch after the archive,
+ * without its extension, so archives found in a directory keep their layout.
+ */
+static int extract_batch_roots(struct extract_archive *archives, const struct mode_inputs *inputs, const struct mode_options *opts) {
+    int status;
+
+    if(opts->manifest != NULL) {
+        error(0, 0, "a manifest can only be kept for a single archive");
+        return EINVAL;
+    }
+
+    for(size_t i = 0; i < inputs->count; i++) {
+        const char *name = inputs->items[i].name;
+        if(strcmp(inputs->items[i].path, "-") == 0) {
+            error(0, 0, "standard input cannot be extracted along with other archives");
+            return EINVAL;
+        }
+
+        size_t len = strlen(name);
+        if(len > 4 && strcasecmp(name + len - 4, ".pbo") == 0) {
+            len -= 4;
+        }
+
+        archives[i].root = strndup(name, len);
+        archives[i].rootfd = -1;
+        if(archives[i].root == NULL) {
+            return errno;
+        }
+    }
+
+    struct extract_archive **sorted = malloc(inputs->count * sizeof(struct extract_archive *));
+    if(sorted == NULL) {
+        return errno;
+    }
+    for(size_t i = 0; i < inputs->count; i++) {
+        sorted[i] = &archives[i];
+    }
+    qsort(sorted, inputs->count, sizeof(struct extract_archive *), extract_root_compare);
+
+    status = 0;
+    for(size_t i = 1; i < inputs->count; i++) {
+        if(strcmp(sorted[i - 1]->root, sorted[i]->root) == 0) {
+            error(0, 0, "%s and %s would both be extracted into %s", sorted[i - 1]->path, sorted[i]->path, sorted[i]->root);
+            status = EEXIST;
+            break;
+        }
+    }
+
+    free(sorted);
+    return status;
+}
+
+int pbo_mode_extract(const char *const *paths, size_t path_count, const char *const *patterns, size_t pattern_count, const struct mode_options *opts) {
+    int status;
+
+    struct mode_stats mstats;
+    mode_stats_init(&mstats, opts);
+
+    mode_stats_phase(&mstats, "collect");
+    struct mode_inputs inputs;
+    status = mode_inputs_collect(&inputs, paths, path_count);
+    if(status != 0) {
+        return status;
+    }
+
+    bool batch = inputs.count > 1;
+    for(size_t i = 0; i < inputs.count; i++) {
+        batch |= inputs.items[i].found;
+    }
+
+    struct extract_archive *archives = calloc(inputs.count > 0 ? inputs.count : 1, sizeof(struct extract_archive));
+    bool *matched = calloc(pattern_count > 0 ? pattern_count : 1, sizeof(bool));
+    if(archives == NULL || matched == NULL) {
+        status = errno;
+        free(archives);
+        free(matched);
+        mode_inputs_destroy(&inputs);
+        return status;
+    }
+
+    for(size_t i = 0; i < inputs.count; i++) {
+        archives[i] = (struct extract_archive) {
+            .path = inputs.items[i].path,
+            .rootfd = AT_FDCWD,
+        };
+    }
+
+    if(batch) {
+        status = extract_batch_roots(archives, &inputs, opts);
+    }
+
+    struct rlimit limit;
+    if(status == 0 && getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        status = errno;
+    }
+    rlim_t nofile = status == 0 && limit.rlim_cur != RLIM_INFINITY ? limit.rlim_cur : 8192;
+
+    // archives are opened a group at a time, each holding its file and output
+    // directory open until the group is done
+    size_t group = nofile / 8 > 0 ? nofile / 8 : 1;
+
+    struct extract_stats stats = { 0 };
+    int failed = 0;
+    for(size_t first = 0; first < inputs.count && status == 0; first += group) {
+        size_t count = inputs.count - first < group ? inputs.count - first : group;
+        struct extract_archive *current = &archives[first];
+
+        // leave half of the descriptor limit for extraction itself
+        size_t budget = nofile / 2;
+        for(size_t i = 0; i < count; i++) {
+            current[i].status = extract_archive_open(&current[i], patterns, pattern_count, matched, &budget, opts, &mstats);
+        }
+
+        // batching through io_uring goes by the job queue even on one thread
+        bool queued = opts->jobs > 1 || opts->io_uring > 0;
+        mode_stats_phase(&mstats, "extract");
+        if(queued) {
+            status = pbo_extract_parallel(current, count, opts->jobs, opts->io_uring > 0, opts->stats);
+        }
+
+        for(size_t i = 0; i < count; i++) {
+            struct extract_archive *ar = &current[i];
+            if(status == 0 && ar->status == 0 && (ar->streaming || !queued)) {
+                mode_stats_phase(&mstats, "extract");
+                ar->status = extract_archive_serial(ar, opts->stats);
+            }
+            if(status == 0 && ar->status == 0 && opts->manifest != NULL) {
+                mode_stats_phase(&mstats, "manifest");
+            }
+            if(status == 0 && ar->status == 0) {
+                ar->status = extract_archive_finish(ar, opts);
+            }
+
+            extract_stats_add(&stats, ar, &mstats);
+            if(status == 0 && batch) {
+                if(ar->status == 0) {
+                    printf("%s: %zu entries extracted\n", ar->path, ar->count);
+                } else {
+                    error(0, ar->status, "failed to extract %s", ar->path);
+                }
+            }
+            if(failed == 0) {
+                failed = ar->status;
+            }
+
+            extract_archive_destroy(ar);
+        }
+    }
+
+    // archives of a group that was never reached still own their roots
+    for(size_t i = stats.archives; i < inputs.count; i++) {
+        extract_archive_destroy(&archives[i]);
+    }
+
+    if(batch) {
+        mode_stats_value(&mstats, "archives", stats.archives);
+        mode_stats_value(&mstats, "archives_failed", stats.failed);
+    }
+    mode_stats_value(&mstats, "directories", stats.dirs);
+    mode_stats_value(&mstats, "directories_created", stats.dirs_created);
+    mode_stats_value(&mstats, "path_syscalls", stats.syscalls);
+    mode_stats_value(&mstats, "path_syscalls_with_per_entry_walks", stats.naive_syscalls);
+    mode_stats_value(&mstats, "entries", stats.extracted);
+    mode_stats_value(&mstats, "entries_in_archives", stats.total);
+    mode_stats_value(&mstats, "entry_bytes", stats.bytes);
+    if(opts->incremental) {
+        mode_stats_value(&mstats, "entries_up_to_date", stats.skipped);
+    }
+    mode_stats_report(&mstats);
+
+    if(status == 0) {
+        status = failed;
+    }
+
+    for(size_t i = 0; i < pattern_count; i++) {
+        if(!matched[i]) {
+            error(0, 0, batch ? "%s: not found in any archive" : "%s: not found in archive", patterns[i]);
+            if(status == 0) {
+                status = ENOENT;
+            }
+        }
+    }
+
+    free(matched);
+    free(archives);
+    mode_inputs_destroy(&inputs);
+    return status;
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <error.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "inputs.h"
+#include "../pbo.h"
+
+static int inputs_add(struct mode_inputs *inputs, const char *path, size_t name, off_t size, bool found) {
+    if(inputs->count == inputs->capacity) {
+        size_t capacity = inputs->capacity > 0 ? inputs->capacity * 2 : 64;
+        struct mode_input *items = realloc(inputs->items, capacity * sizeof(struct mode_input));
+        if(items == NULL) {
+            return errno;
+        }
+        inputs->items = items;
+        inputs->capacity = capacity;
+    }
+
+    char *copy = strdup(path);
+    if(copy == NULL) {
+        return errno;
+    }
+
+    inputs->items[inputs->count++] = (struct mode_input) {
+        .path = copy,
+        .name = copy + name,
+        .size = size,
+        .found = found,
+    };
+    return 0;
+}
+
+struct inputs_dir {
+    dev_t dev;
+    ino_t ino;
+};
+
+// directories searched so far, sorted by id
+struct inputs_seen {
+    struct inputs_dir *dirs;
+    size_t count, capacity;
+};
+
+static int inputs_dir_compare(const void *a, const void *b) {
+    const struct inputs_dir *da = a, *db = b;
+
+    if(da->dev != db->dev) {
+        return da->dev < db->dev ? -1 : 1;
+    }
+    return (da->ino > db->ino) - (da->ino < db->ino);
+}
+
+/*
+ * Records a directory about to be searched. Sets *seen instead if it was
+ * searched already, as happens when a symbolic link leads back to an
+ * ancestor or to another directory on the way.
+ */
+static int inputs_visit(struct inputs_seen *seen, const struct stat *info, bool *visited) {
+    struct inputs_dir dir = {
+        .dev = info->st_dev,
+        .ino = info->st_ino,
+    };
+
+    size_t lo = 0, hi = seen->count;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = inputs_dir_compare(&dir, &seen->dirs[mid]);
+        if(cmp == 0) {
+            *visited = true;
+            return 0;
+        } else if(cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    if(seen->count == seen->capacity) {
+        size_t capacity = seen->capacity > 0 ? seen->capacity * 2 : 64;
+        struct inputs_dir *dirs = realloc(seen->dirs, capacity * sizeof(struct inputs_dir));
+        if(dirs == NULL) {
+            return errno;
+        }
+        seen->dirs = dirs;
+        seen->capacity = capacity;
+    }
+
+    memmove(seen->dirs + lo + 1, seen->dirs + lo, (seen->count - lo) * sizeof(struct inputs_dir));
+    seen->dirs[lo] = dir;
+    seen->count++;
+    *visited = false;
+    return 0;
+}
+
+static bool inputs_is_pbo(const char *name) {
+    size_t len = strlen(name);
+    return len > 4 && strcasecmp(name + len - 4, ".pbo") == 0;
+}
+
+static int inputs_walk(struct mode_inputs *inputs, struct inputs_seen *seen, char *pathbuf, size_t pathlen, size_t rootlen) {
+    int status;
+
+    struct dirent **names;
+    int count = scandir(pathbuf, &names, NULL, alphasort);
+    if(count < 0) {
+        return errno;
+    }
+
+    status = 0;
+    for(int i = 0; i < count && status == 0; i++) {
+        const char *name = names[i]->d_name;
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        size_t namelen = strlen(name);
+        if(pathlen + 1 + namelen >= PATH_MAX) {
+            status = ENAMETOOLONG;
+            break;
+        }
+        pathbuf[pathlen] = '/';
+        memcpy(pathbuf + pathlen + 1, name, namelen + 1);
+
+        struct stat info;
+        bool visited;
+        pbo_count(PBO_COUNTER_STAT, 1);
+        if(stat(pathbuf, &info) != 0) {
+            status = errno;
+        } else if(S_ISDIR(info.st_mode)) {
+            status = inputs_visit(seen, &info, &visited);
+            if(status == 0 && !visited) {
+                status = inputs_walk(inputs, seen, pathbuf, pathlen + 1 + namelen, rootlen);
+            }
+        } else if(S_ISREG(info.st_mode) && inputs_is_pbo(name)) {
+            status = inputs_add(inputs, pathbuf, rootlen + 1, info.st_size, true);
+        }
+    }
+
+    pathbuf[pathlen] = '\0';
+
+    for(int i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+    return status;
+}
+
+static int inputs_collect_one(struct mode_inputs *inputs, struct inputs_seen *seen, const char *path) {
+    // standard input is not looked at until it is read
+    if(strcmp(path, "-") == 0) {
+        return inputs_add(inputs, path, 0, 0, false);
+    }
+
+    struct stat info;
+    pbo_count(PBO_COUNTER_STAT, 1);
+    if(stat(path, &info) != 0) {
+        return errno;
+    }
+
+    if(!S_ISDIR(info.st_mode)) {
+        const char *name = strrchr(path, '/');
+        return inputs_add(inputs, path, name != NULL ? (size_t) (name + 1 - path) : 0, info.st_size, false);
+    }
+
+    bool visited;
+    int status = inputs_visit(seen, &info, &visited);
+    if(status != 0 || visited) {
+        return status;
+    }
+
+    char pathbuf[PATH_MAX];
+    size_t len = strlen(path);
+    if(len >= PATH_MAX) {
+        return ENAMETOOLONG;
+    }
+    memcpy(pathbuf, path, len + 1);
+
+    // a trailing slash would otherwise be doubled up
+    while(len > 1 && pathbuf[len - 1] == '/') {
+        pathbuf[--len] = '\0';
+    }
+    return inputs_walk(inputs, seen, pathbuf, len, len);
+}
+
+int mode_inputs_collect(struct mode_inputs *inputs, const char *const *paths, size_t count) {
+    *inputs = (struct mode_inputs) { 0 };
+
+    struct inputs_seen seen = { 0 };
+    for(size_t i = 0; i < count; i++) {
+        int status = inputs_collect_one(inputs, &seen, paths[i]);
+        if(status != 0) {
+            error(0, status, "failed to read %s", paths[i]);
+            free(seen.dirs);
+            mode_inputs_destroy(inputs);
+            return status;
+        }
+    }
+
+    free(seen.dirs);
+    return 0;
+}
+
+void mode_inputs_destroy(struct mode_inputs *inputs) {
+    for(size_t i = 0; i < inputs->count; i++) {
+        free(inputs->items[i].path);
+    }
+    free(inputs->items);
+    *inputs = (struct mode_inputs) { 0 };
+}
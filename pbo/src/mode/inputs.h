@@ -0,0 +1,42 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct mode_input {
+    char *path;
+    const char *name; // part of path below the directory it was found in, or the file name
+    off_t size;
+    bool found; // in a directory rather than named directly
+};
+
+struct mode_inputs {
+    struct mode_input *items;
+    size_t count, capacity;
+};
+
+/*
+ * Expands the given paths into the PBOs to process: files are taken as is,
+ * directories are searched recursively for *.pbo in name order, each once
+ * however many paths or links lead to it. Reports the path that could not
+ * be read.
+ */
+int mode_inputs_collect(struct mode_inputs *inputs, const char *const *paths, size_t count);
+void mode_inputs_destroy(struct mode_inputs *inputs);
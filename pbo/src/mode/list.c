@@ -15,49 +15,245 @@
  */
 
 #include <errno.h>
-#include <limits.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "inputs.h"
 #include "mode.h"
+#include "stats.h"
 #include "../pbo.h"
+#include "../pool/pool.h"
 
-int pbo_mode_list(const char *path) {
+// archives listed into memory at once by several threads
+#define LIST_GROUP 64
+
+struct list_archive {
+    const char *path;
+    const struct mode_options *opts;
+    PBO_CACHE *cache;
+
+    FILE *out;
+    char *text; // what was listed into memory
+    size_t text_len;
+
+    size_t entries;
     int status;
 
-    struct pbo *pbo = NULL;
-    status = pbo_init(&pbo);
-    if(status != 0) {
-        return status;
+    // entries of an archive mostly share a timestamp, formatted once
+    time_t when;
+    char when_text[32];
+};
+
+static int list_property(void *ctx, const char *key, const char *value) {
+    struct list_archive *ar = ctx;
+
+    // only machine readable listings carry the properties
+    if(ar->opts->list_json) {
+        fputs("{\"archive\":", ar->out);
+        mode_json_string(ar->out, ar->path);
+        fputs(",\"property\":", ar->out);
+        mode_json_string(ar->out, key);
+        fputs(",\"value\":", ar->out);
+        mode_json_string(ar->out, value);
+        fputs("}\n", ar->out);
     }
 
-    FILE *file = fopen(path, "r");
-    if(file == NULL) {
-        status = errno;
-        pbo_destroy(pbo);
-        return status;
+    return ferror(ar->out) ? EIO : 0;
+}
+
+static int list_entry(void *ctx, PBO_ENTRY *ent) {
+    struct list_archive *ar = ctx;
+    ar->entries++;
+
+    const char *path = pbo_entry_path(ent);
+    intmax_t size = pbo_entry_original_size(ent), packed = pbo_entry_data_size(ent), offset = pbo_entry_offset(ent);
+    time_t timestamp = pbo_entry_timestamp(ent);
+
+    if(ar->opts->list_json) {
+        fputs("{\"archive\":", ar->out);
+        mode_json_string(ar->out, ar->path);
+        fputs(",\"path\":", ar->out);
+        mode_json_string(ar->out, path);
+        fprintf(ar->out, ",\"type\":\"%s\",\"size\":%jd,\"packed_size\":%jd,\"offset\":%jd,\"timestamp\":%jd}\n",
+            pbo_entry_is_compressed(ent) ? "compressed" : "stored", size, packed, offset, (intmax_t) timestamp);
+    } else if(ar->opts->list_long) {
+        struct tm tm;
+        if(timestamp != ar->when || ar->when_text[0] == '\0') {
+            ar->when = timestamp;
+            if(timestamp == 0 || localtime_r(&timestamp, &tm) == NULL || strftime(ar->when_text, sizeof(ar->when_text), "%Y-%m-%d %H:%M", &tm) == 0) {
+                strcpy(ar->when_text, "-");
+            }
+        }
+        fprintf(ar->out, "%c %10jd %10jd %16s %12jd %s\n", pbo_entry_is_compressed(ent) ? 'c' : '-', size, packed, ar->when_text, offset, path);
+    } else {
+        fprintf(ar->out, "%s\n", path);
     }
 
-    status = pbo_load(pbo, file);
-    if(status != 0) {
-        fclose(file);
-        pbo_destroy(pbo);
-        return status;
+    return ferror(ar->out) ? EIO : 0;
+}
+
+/*
+ * Lists from the index cache if there is one, which needs the whole header
+ * in memory, and otherwise straight from the header as it is scanned.
+ */
+static int list_archive(struct list_archive *ar) {
+    int status;
+
+    if(ar->cache != NULL && strcmp(ar->path, "-") != 0) {
+        PBO *pbo;
+        status = pbo_init(&pbo);
+        if(status != 0) {
+            return status;
+        }
+
+        status = pbo_cache_load(ar->cache, pbo, ar->path);
+        for(PBO_PROPERTY *prop = pbo_get_properties(pbo); status == 0 && prop != NULL; prop = pbo_property_next(prop)) {
+            status = list_property(ar, pbo_property_key(prop), pbo_property_value(prop));
+        }
+        for(PBO_ENTRY *ent = pbo_get_entries(pbo); status == 0 && ent != NULL; ent = pbo_entry_next(ent)) {
+            status = list_entry(ar, ent);
+        }
+
+        int destroyed = pbo_destroy(pbo);
+        return status != 0 ? status : destroyed;
     }
 
-    for(PBO_ENTRY *ent = pbo_get_entries(pbo); ent != NULL; ent = pbo_entry_next(ent)) {
-        fprintf(stdout, "%s\n", pbo_entry_path(ent));
+    pbo_count(PBO_COUNTER_OPEN, 1);
+    int fd = strcmp(ar->path, "-") == 0 ? STDIN_FILENO : open(ar->path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return errno;
     }
 
-    if(fclose(file) != 0) {
-        status = errno;
-        pbo_destroy(pbo);
-        return status;
+    const struct pbo_scan_callbacks callbacks = {
+        .property = list_property,
+        .entry = list_entry,
+    };
+    status = pbo_scan(fd, &callbacks, ar);
+
+    if(fd != STDIN_FILENO) {
+        close(fd);
     }
+    return status;
+}
+
+static void list_worker(void *arg, size_t i) {
+    struct list_archive *ar = &((struct list_archive *) arg)[i];
+
+    ar->out = open_memstream(&ar->text, &ar->text_len);
+    if(ar->out == NULL) {
+        ar->status = errno;
+        return;
+    }
+
+    ar->status = list_archive(ar);
+    if(fclose(ar->out) != 0 && ar->status == 0) {
+        ar->status = errno;
+    }
+}
+
+int pbo_mode_list(const char *const *paths, size_t count, const struct mode_options *opts) {
+    int status;
 
-    status = pbo_destroy(pbo);
+    struct mode_stats stats;
+    mode_stats_init(&stats, opts);
+
+    mode_stats_phase(&stats, "collect");
+    struct mode_inputs inputs;
+    status = mode_inputs_collect(&inputs, paths, count);
     if(status != 0) {
         return status;
     }
 
-    return 0;
+    PBO_CACHE *cache = NULL;
+    if(opts->index_cache != NULL) {
+        status = pbo_cache_open(&cache, opts->index_cache);
+        if(status != 0) {
+            error(0, status, "failed to open index cache %s", opts->index_cache);
+            mode_inputs_destroy(&inputs);
+            return status;
+        }
+    }
+
+    bool batch = inputs.count > 1;
+    for(size_t i = 0; i < inputs.count; i++) {
+        batch |= inputs.items[i].found;
+    }
+
+    // JSON lines name their archive instead of being grouped under it
+    bool headings = batch && !opts->list_json;
+    bool buffered = opts->jobs > 1 && inputs.count > 1;
+
+    struct list_archive archives[LIST_GROUP];
+    size_t entries = 0;
+    int failed = 0;
+    for(size_t first = 0, group; first < inputs.count && status == 0; first += group) {
+        group = inputs.count - first < LIST_GROUP ? inputs.count - first : LIST_GROUP;
+        if(!buffered) {
+            group = 1;
+        }
+
+        for(size_t i = 0; i < group; i++) {
+            archives[i] = (struct list_archive) {
+                .path = inputs.items[first + i].path,
+                .opts = opts,
+                .cache = cache,
+                .out = stdout,
+            };
+        }
+
+        // archives are listed in parallel but printed in order
+        mode_stats_phase(&stats, "scan");
+        if(buffered) {
+            status = pool_run(opts->jobs, group, list_worker, archives);
+        } else {
+            if(headings) {
+                printf("%s%s:\n", first > 0 ? "\n" : "", archives[0].path);
+            }
+            archives[0].status = list_archive(&archives[0]);
+        }
+
+        mode_stats_phase(&stats, "print");
+        for(size_t i = 0; i < group; i++) {
+            struct list_archive *ar = &archives[i];
+            if(status == 0 && buffered) {
+                if(headings) {
+                    printf("%s%s:\n", first + i > 0 ? "\n" : "", ar->path);
+                }
+                fwrite(ar->text, 1, ar->text_len, stdout);
+            }
+            free(ar->text);
+
+            if(status == 0 && ar->status != 0 && batch) {
+                error(0, ar->status, "failed to list %s", ar->path);
+            }
+            if(failed == 0) {
+                failed = ar->status;
+            }
+            entries += ar->entries;
+        }
+    }
+
+    if(cache != NULL) {
+        mode_stats_phase(&stats, "save");
+        int closed = pbo_cache_close(cache);
+        if(closed != 0) {
+            error(0, closed, "failed to save index cache %s", opts->index_cache);
+            if(status == 0) {
+                status = closed;
+            }
+        }
+    }
+
+    mode_stats_value(&stats, "archives", inputs.count);
+    mode_stats_value(&stats, "entries", entries);
+    mode_stats_report(&stats);
+
+    mode_inputs_destroy(&inputs);
+    return status != 0 ? status : failed;
 }
@@ -0,0 +1,224 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "manifest.h"
+
+static int manifest_record_compare(const void *a, const void *b) {
+    const struct manifest_record *ra = a, *rb = b;
+    return strcmp(ra->path, rb->path);
+}
+
+static int manifest_record_order(const void *a, const void *b) {
+    const struct manifest_record *ra = a, *rb = b;
+
+    int cmp = strcmp(ra->path, rb->path);
+    if(cmp != 0) {
+        return cmp;
+    }
+    return (ra->seq > rb->seq) - (ra->seq < rb->seq);
+}
+
+// sorts the records by path, keeping only the one added last for each path
+static void manifest_sort(struct manifest *manifest) {
+    qsort(manifest->records, manifest->count, sizeof(struct manifest_record), manifest_record_order);
+
+    size_t count = 0;
+    for(size_t i = 0; i < manifest->count; i++) {
+        if(i + 1 < manifest->count && strcmp(manifest->records[i].path, manifest->records[i + 1].path) == 0) {
+            free(manifest->records[i].path);
+            continue;
+        }
+        manifest->records[count++] = manifest->records[i];
+    }
+    manifest->count = count;
+    manifest->sorted = count;
+}
+
+static int manifest_append(struct manifest *manifest, const char *path, const unsigned char digest[PBO_DIGEST_SIZE], off_t size, struct timespec mtime) {
+    if(manifest->count == manifest->capacity) {
+        size_t capacity = manifest->capacity > 0 ? manifest->capacity * 2 : 64;
+        struct manifest_record *records = realloc(manifest->records, capacity * sizeof(struct manifest_record));
+        if(records == NULL) {
+            return errno;
+        }
+        manifest->records = records;
+        manifest->capacity = capacity;
+    }
+
+    char *copy = strdup(path);
+    if(copy == NULL) {
+        return errno;
+    }
+
+    struct manifest_record *record = &manifest->records[manifest->count++];
+    record->path = copy;
+    memcpy(record->digest, digest, PBO_DIGEST_SIZE);
+    record->size = size;
+    record->mtime = mtime;
+    record->seq = manifest->count - 1;
+    return 0;
+}
+
+static int manifest_parse_line(struct manifest *manifest, char *line) {
+    unsigned char digest[PBO_DIGEST_SIZE];
+    for(size_t i = 0; i < PBO_DIGEST_SIZE; i++) {
+        unsigned int byte;
+        if(sscanf(line + 2 * i, "%2x", &byte) != 1) {
+            return EINVAL;
+        }
+        digest[i] = byte;
+    }
+
+    long long size, sec;
+    long nsec;
+    int pathpos = 0;
+    if(sscanf(line + 2 * PBO_DIGEST_SIZE, " %lld %lld.%ld %n", &size, &sec, &nsec, &pathpos) != 3 || pathpos == 0) {
+        return EINVAL;
+    }
+
+    const char *path = line + 2 * PBO_DIGEST_SIZE + pathpos;
+    if(*path == '\0') {
+        return EINVAL;
+    }
+
+    return manifest_append(manifest, path, digest, size, (struct timespec) { .tv_sec = sec, .tv_nsec = nsec });
+}
+
+int manifest_load(struct manifest *manifest, const char *path) {
+    int status;
+
+    *manifest = (struct manifest) { 0 };
+
+    FILE *file = fopen(path, "r");
+    if(file == NULL) {
+        // nothing extracted yet
+        return errno == ENOENT ? 0 : errno;
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    status = 0;
+    while((len = getline(&line, &line_cap, file)) > 0) {
+        if(line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+
+        status = manifest_parse_line(manifest, line);
+        if(status != 0) {
+            break;
+        }
+    }
+    free(line);
+
+    if(status == 0 && ferror(file)) {
+        status = EIO;
+    }
+    fclose(file);
+
+    if(status != 0) {
+        manifest_destroy(manifest);
+        return status;
+    }
+
+    manifest_sort(manifest);
+    return 0;
+}
+
+const struct manifest_record * manifest_find(const struct manifest *manifest, const char *path) {
+    struct manifest_record key = {
+        .path = (char *) path,
+    };
+    return bsearch(&key, manifest->records, manifest->sorted, sizeof(struct manifest_record), manifest_record_compare);
+}
+
+/*
+ * New paths are appended past the sorted records, so lookups only see what
+ * was loaded; saving sorts everything again.
+ */
+int manifest_set(struct manifest *manifest, const char *path, const unsigned char digest[PBO_DIGEST_SIZE], const struct stat *info) {
+    if(strchr(path, '\n') != NULL) {
+        return EINVAL;
+    }
+
+    struct manifest_record *record = (struct manifest_record *) manifest_find(manifest, path);
+    if(record != NULL) {
+        memcpy(record->digest, digest, PBO_DIGEST_SIZE);
+        record->size = info->st_size;
+        record->mtime = info->st_mtim;
+        return 0;
+    }
+
+    return manifest_append(manifest, path, digest, info->st_size, info->st_mtim);
+}
+
+int manifest_save(struct manifest *manifest, const char *path) {
+    int status;
+
+    manifest_sort(manifest);
+
+    size_t pathlen = strlen(path);
+    char *tmppath = malloc(pathlen + sizeof(".tmp"));
+    if(tmppath == NULL) {
+        return errno;
+    }
+    memcpy(tmppath, path, pathlen);
+    memcpy(tmppath + pathlen, ".tmp", sizeof(".tmp"));
+
+    FILE *file = fopen(tmppath, "w");
+    if(file == NULL) {
+        status = errno;
+        free(tmppath);
+        return status;
+    }
+
+    for(size_t i = 0; i < manifest->count; i++) {
+        const struct manifest_record *record = &manifest->records[i];
+        for(size_t j = 0; j < PBO_DIGEST_SIZE; j++) {
+            fprintf(file, "%02x", record->digest[j]);
+        }
+        fprintf(file, " %lld %lld.%09ld %s\n", (long long) record->size, (long long) record->mtime.tv_sec, record->mtime.tv_nsec, record->path);
+    }
+
+    // replace the old manifest only once the new one is complete
+    status = ferror(file) ? EIO : 0;
+    if(fclose(file) != 0 && status == 0) {
+        status = errno;
+    }
+    if(status == 0 && rename(tmppath, path) != 0) {
+        status = errno;
+    }
+    if(status != 0) {
+        unlink(tmppath);
+    }
+
+    free(tmppath);
+    return status;
+}
+
+void manifest_destroy(struct manifest *manifest) {
+    for(size_t i = 0; i < manifest->count; i++) {
+        free(manifest->records[i].path);
+    }
+    free(manifest->records);
+    *manifest = (struct manifest) { 0 };
+}
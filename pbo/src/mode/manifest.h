@@ -0,0 +1,48 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "../pbo.h"
+
+struct manifest_record {
+    char *path; // relative to the output root, '/'-separated
+    unsigned char digest[PBO_DIGEST_SIZE]; // of the entry data it was written from
+    off_t size;
+    struct timespec mtime;
+    size_t seq; // order the record was added in, the last of a path wins
+};
+
+/*
+ * A manifest remembers what each extracted file was written from, one
+ * "DIGEST SIZE MTIME PATH" line per file. A file whose size and mtime still
+ * match its record has not been touched since, so comparing digests tells
+ * whether the entry it came from changed.
+ */
+struct manifest {
+    struct manifest_record *records;
+    size_t count, capacity;
+    size_t sorted; // leading records in path order
+};
+
+int manifest_load(struct manifest *manifest, const char *path);
+const struct manifest_record * manifest_find(const struct manifest *manifest, const char *path);
+int manifest_set(struct manifest *manifest, const char *path, const unsigned char digest[PBO_DIGEST_SIZE], const struct stat *info);
+int manifest_save(struct manifest *manifest, const char *path);
+void manifest_destroy(struct manifest *manifest);
@@ -16,6 +16,51 @@
 
 #pragma once
 
-int pbo_mode_list(const char *path);
+#include <stdbool.h>
+#include <stddef.h>
 
-int pbo_mode_extract(const char *path);
+enum mode_order {
+    MODE_ORDER_PATH,
+    MODE_ORDER_TYPE, // by extension, then path
+    MODE_ORDER_SIZE, // smallest first, then path
+};
+
+struct mode_options {
+    unsigned jobs;
+    unsigned io_uring; // files in flight per ring, 0 for blocking I/O
+    bool stats;
+    bool stats_json; // print stats as one JSON object instead of lines
+    int compress; // LZSS effort level, 0 to store entries as is
+    enum mode_order order; // of the entries of created PBOs
+
+    bool incremental; // skip entries whose file on disk is up to date, or update a PBO in place
+    const char *manifest; // file keeping the content hashes of extracted files
+    const char *index_cache; // file keeping parsed headers between listings
+    bool list_long; // list type, sizes, timestamp and offset of each entry
+    bool list_json; // list properties and entries as one JSON object per line
+
+    const char **properties; // KEY=VALUE
+    size_t property_count;
+};
+
+/*
+ * Modes that read PBOs take any number of files and directories, which are
+ * searched for *.pbo. Each archive is reported on its own when there is more
+ * than one. Listing prints each entry as soon as its header record is read,
+ * unless several archives are listed by several threads; those are printed
+ * in order once listed.
+ */
+int pbo_mode_list(const char *const *paths, size_t count, const struct mode_options *opts);
+
+/*
+ * Extracts the entries matching any of the patterns, or every entry if none
+ * are given. Patterns are shell globs matched case-insensitively against the
+ * whole path or a leading directory of it, with either separator. A single
+ * archive is extracted into the current directory; several are extracted
+ * into directories named after them, sharing one pool of threads.
+ */
+int pbo_mode_extract(const char *const *paths, size_t path_count, const char *const *patterns, size_t pattern_count, const struct mode_options *opts);
+
+int pbo_mode_pack(const char *path, const char *dir, const struct mode_options *opts);
+
+int pbo_mode_verify(const char *const *paths, size_t count, const struct mode_options *opts);
@@ -0,0 +1,435 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mode.h"
+#include "stats.h"
+#include "walk.h"
+#include "../pbo.h"
+#include "../pool/pool.h"
+
+// larger entries are stored as is rather than held in memory
+#define PACK_COMPRESS_MAX (64L << 20)
+
+// types the game reads through its compressed entry path
+static const char *const pack_compress_types[] = {
+    ".bisurf", ".cfg", ".cpp", ".csv", ".ext", ".fsm", ".h", ".hpp",
+    ".inc", ".rvmat", ".sqf", ".sqm", ".sqs", ".txt", ".xml",
+};
+
+struct pack_walk_ctx {
+    PBO *pbo;
+    PBO *old; // archive being updated, or NULL
+    const struct stat *outinfo;
+
+    size_t reused;
+    off_t reused_bytes;
+};
+
+static bool pack_same_content(const char *source, const char *data, size_t len) {
+    pbo_count(PBO_COUNTER_OPEN, 1);
+    int fd = open(source, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+
+    bool same = true;
+    for(size_t pos = 0; pos < len && same;) {
+        char buf[65536];
+        ssize_t rlen = read(fd, buf, len - pos < sizeof(buf) ? len - pos : sizeof(buf));
+        if(rlen <= 0) {
+            same = false;
+            break;
+        }
+        same = memcmp(buf, data + pos, rlen) == 0;
+        pos += rlen;
+        pbo_count(PBO_COUNTER_READ, 1);
+        pbo_count(PBO_COUNTER_BYTES_READ, rlen);
+    }
+
+    close(fd);
+    return same;
+}
+
+/*
+ * Lets the entry just added for `source` keep the data of the same path in
+ * the archive being updated, if the file did not change. Files whose mtime
+ * does not match the old timestamp are compared by content.
+ */
+static int pack_reuse(struct pack_walk_ctx *ctx, const char *path, const char *source, const struct stat *info) {
+    PBO_ENTRY *from = pbo_find_entry(ctx->old, path);
+    if(from == NULL || pbo_entry_original_size(from) != info->st_size) {
+        return 0;
+    }
+
+    if(pbo_entry_timestamp(from) == 0 || pbo_entry_timestamp(from) != info->st_mtime) {
+        const void *data;
+        size_t len;
+        if(pbo_entry_is_compressed(from) || pbo_entry_data(from, &data, &len) != 0 || !pack_same_content(source, data, len)) {
+            return 0;
+        }
+    }
+
+    PBO_ENTRY *ent = pbo_get_entry(ctx->pbo, pbo_get_entry_count(ctx->pbo) - 1);
+    int status = pbo_entry_reuse(ent, from);
+    if(status != 0) {
+        return status;
+    }
+
+    ctx->reused++;
+    ctx->reused_bytes += pbo_entry_data_size(ent);
+    return 0;
+}
+
+static int pack_add(struct pack_walk_ctx *ctx, const char *dir, const struct pack_tree *tree) {
+    int status;
+
+    char srcbuf[PATH_MAX], pathbuf[PATH_MAX];
+    size_t dirlen = strlen(dir);
+    if(dirlen >= PATH_MAX) {
+        return ENAMETOOLONG;
+    }
+    memcpy(srcbuf, dir, dirlen);
+    srcbuf[dirlen] = '/';
+
+    for(size_t i = 0; i < tree->file_count; i++) {
+        const struct pack_file *file = &tree->files[i];
+        if(file->info.st_dev == ctx->outinfo->st_dev && file->info.st_ino == ctx->outinfo->st_ino) {
+            continue;
+        }
+
+        size_t len = strlen(file->path);
+        if(dirlen + 1 + len >= PATH_MAX) {
+            return ENAMETOOLONG;
+        }
+        memcpy(srcbuf + dirlen + 1, file->path, len + 1);
+        for(size_t j = 0; j <= len; j++) {
+            pathbuf[j] = file->path[j] == '/' ? PBO_PATH_SEPARATOR[0] : file->path[j];
+        }
+
+        status = pbo_add_entry(ctx->pbo, pathbuf, srcbuf, &file->info);
+        if(status == 0 && ctx->old != NULL) {
+            status = pack_reuse(ctx, pathbuf, srcbuf, &file->info);
+        }
+        if(status != 0) {
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+static int pack_properties(PBO *pbo, PBO *old, const struct mode_options *opts) {
+    int status;
+
+    // an update keeps the properties of the archive unless new ones are given
+    if(old != NULL && opts->property_count == 0) {
+        for(size_t i = 0; i < pbo_get_property_count(old); i++) {
+            PBO_PROPERTY *prop = pbo_get_property(old, i);
+            status = pbo_add_property(pbo, pbo_property_key(prop), pbo_property_value(prop));
+            if(status != 0) {
+                return status;
+            }
+        }
+        return 0;
+    }
+
+    for(size_t i = 0; i < opts->property_count; i++) {
+        const char *sep = strchr(opts->properties[i], '=');
+        if(sep == NULL || (size_t) (sep - opts->properties[i]) >= 32) {
+            return EINVAL;
+        }
+
+        char key[32];
+        memcpy(key, opts->properties[i], sep - opts->properties[i]);
+        key[sep - opts->properties[i]] = '\0';
+
+        status = pbo_add_property(pbo, key, sep + 1);
+        if(status != 0) {
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+static bool pack_compressible(PBO_ENTRY *ent) {
+    const char *path = pbo_entry_path(ent);
+    const char *ext = strrchr(path, '.');
+    if(ext == NULL || strchr(ext, PBO_PATH_SEPARATOR[0]) != NULL) {
+        return false;
+    }
+
+    off_t size = pbo_entry_data_size(ent);
+    if(size < 16 || size > PACK_COMPRESS_MAX) {
+        return false;
+    }
+
+    for(size_t i = 0; i < sizeof(pack_compress_types) / sizeof(*pack_compress_types); i++) {
+        if(strcasecmp(ext, pack_compress_types[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct pack_compress_ctx {
+    PBO_ENTRY **entries;
+    int *results;
+    int level;
+};
+
+static void pack_compress_worker(void *arg, size_t index) {
+    struct pack_compress_ctx *ctx = arg;
+    ctx->results[index] = pbo_entry_compress(ctx->entries[index], ctx->level);
+}
+
+static int pack_compress(PBO *pbo, const struct mode_options *opts) {
+    int status;
+
+    size_t count = pbo_get_entry_count(pbo);
+    PBO_ENTRY **entries = malloc((count > 0 ? count : 1) * sizeof(*entries));
+    int *results = calloc(count > 0 ? count : 1, sizeof(*results));
+    if(entries == NULL || results == NULL) {
+        status = errno;
+        free(entries);
+        free(results);
+        return status;
+    }
+
+    size_t queued = 0;
+    for(size_t i = 0; i < count; i++) {
+        PBO_ENTRY *ent = pbo_get_entry(pbo, i);
+        if(pack_compressible(ent)) {
+            entries[queued++] = ent;
+        }
+    }
+
+    struct pack_compress_ctx ctx = {
+        .entries = entries,
+        .results = results,
+        .level = opts->compress,
+    };
+    status = pool_run(opts->jobs, queued, pack_compress_worker, &ctx);
+
+    for(size_t i = 0; i < queued && status == 0; i++) {
+        status = results[i];
+    }
+
+    free(entries);
+    free(results);
+    return status;
+}
+
+/*
+ * Fills `pbo` from the directory tree, skipping the file described by
+ * `outinfo`. With `old` set, unchanged files keep their data from it.
+ */
+static int pack_build(PBO *pbo, const char *dir, PBO *old, const struct stat *outinfo, const struct mode_options *opts, struct mode_stats *stats) {
+    int status;
+
+    status = pack_properties(pbo, old, opts);
+    if(status != 0) {
+        return status;
+    }
+
+    struct pack_tree tree;
+    mode_stats_phase(stats, "walk");
+    status = pack_tree_walk(&tree, dir, opts->order, opts->jobs);
+    if(status != 0) {
+        return status;
+    }
+
+    struct pack_walk_ctx ctx = {
+        .pbo = pbo,
+        .old = old,
+        .outinfo = outinfo,
+    };
+    status = pack_add(&ctx, dir, &tree);
+    mode_stats_value(stats, "directories", tree.dir_count);
+    pack_tree_destroy(&tree);
+    if(status != 0) {
+        return status;
+    }
+
+    if(opts->compress > 0) {
+        mode_stats_phase(stats, "compress");
+        status = pack_compress(pbo, opts);
+        if(status != 0) {
+            return status;
+        }
+    }
+
+    mode_stats_value(stats, "entries", pbo_get_entry_count(pbo));
+    if(old != NULL) {
+        mode_stats_value(stats, "entries_reused", ctx.reused);
+        mode_stats_value(stats, "bytes_reused", ctx.reused_bytes);
+    }
+
+    return 0;
+}
+
+/*
+ * Saves the archive to a temporary file next to `path` and renames it over
+ * `path`, so that a failure leaves any existing archive as it was.
+ */
+static int pack_write(PBO *pbo, const char *path, mode_t mode, struct mode_stats *stats) {
+    int status;
+
+    size_t pathlen = strlen(path);
+    char *tmppath = malloc(pathlen + sizeof(".XXXXXX"));
+    if(tmppath == NULL) {
+        return errno;
+    }
+    memcpy(tmppath, path, pathlen);
+    memcpy(tmppath + pathlen, ".XXXXXX", sizeof(".XXXXXX"));
+
+    int fd = mkstemp(tmppath);
+    FILE *file = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if(file == NULL) {
+        status = errno;
+        if(fd >= 0) {
+            close(fd);
+            unlink(tmppath);
+        }
+        free(tmppath);
+        return status;
+    }
+
+    mode_stats_phase(stats, "save");
+    status = fchmod(fd, mode) != 0 ? errno : pbo_save(pbo, file);
+    if(fclose(file) != 0 && status == 0) {
+        status = errno;
+    }
+    if(status == 0 && rename(tmppath, path) != 0) {
+        status = errno;
+    }
+    if(status != 0) {
+        unlink(tmppath);
+    }
+
+    free(tmppath);
+    return status;
+}
+
+static int pack_create(const char *path, const char *dir, const struct mode_options *opts, struct mode_stats *stats) {
+    int status;
+
+    // never pack an existing output into itself; a new one keeps the mode fopen() would give it
+    struct stat outinfo = { 0 };
+    if(stat(path, &outinfo) != 0) {
+        if(errno != ENOENT) {
+            return errno;
+        }
+        mode_t mask = umask(0);
+        umask(mask);
+        outinfo = (struct stat) {
+            .st_mode = 0666 & ~mask,
+        };
+    }
+
+    struct pbo *pbo = NULL;
+    status = pbo_init(&pbo);
+    if(status != 0) {
+        return status;
+    }
+
+    status = pack_build(pbo, dir, NULL, &outinfo, opts, stats);
+    if(status == 0) {
+        status = pack_write(pbo, path, outinfo.st_mode & 07777, stats);
+    }
+
+    pbo_destroy(pbo);
+    return status;
+}
+
+/*
+ * Rebuilds an existing archive next to it and renames the result over it.
+ * Unchanged entries are copied from the old archive as stored, so only new
+ * and modified files are read and compressed again.
+ */
+static int pack_update(const char *path, int oldfd, const char *dir, const struct mode_options *opts, struct mode_stats *stats) {
+    int status;
+
+    struct stat oldinfo;
+    if(fstat(oldfd, &oldinfo) != 0) {
+        return errno;
+    }
+
+    struct pbo *old = NULL;
+    status = pbo_init(&old);
+    if(status != 0) {
+        return status;
+    }
+
+    mode_stats_phase(stats, "load");
+    status = pbo_load_mmap(old, oldfd);
+    if(status != 0) {
+        pbo_destroy(old);
+        return status;
+    }
+
+    struct pbo *pbo = NULL;
+    status = pbo_init(&pbo);
+    if(status != 0) {
+        pbo_destroy(old);
+        return status;
+    }
+
+    status = pack_build(pbo, dir, old, &oldinfo, opts, stats);
+    if(status == 0) {
+        status = pack_write(pbo, path, oldinfo.st_mode & 07777, stats);
+    }
+
+    pbo_destroy(pbo);
+    pbo_destroy(old);
+    return status;
+}
+
+int pbo_mode_pack(const char *path, const char *dir, const struct mode_options *opts) {
+    int status;
+
+    struct mode_stats stats;
+    mode_stats_init(&stats, opts);
+
+    int oldfd = -1;
+    if(opts->incremental) {
+        oldfd = open(path, O_RDONLY | O_CLOEXEC);
+        if(oldfd < 0 && errno != ENOENT) {
+            return errno;
+        }
+    }
+
+    if(oldfd < 0) {
+        status = pack_create(path, dir, opts, &stats);
+    } else {
+        status = pack_update(path, oldfd, dir, opts, &stats);
+        close(oldfd);
+    }
+
+    mode_stats_report(&stats);
+    return status;
+}
@@ -0,0 +1,267 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "plan.h"
+
+struct extract_prefix {
+    const char *path;
+    size_t len;
+};
+
+static int extract_prefix_compare(const void *a, const void *b) {
+    const struct extract_prefix *pa = a, *pb = b;
+
+    int cmp = memcmp(pa->path, pb->path, pa->len < pb->len ? pa->len : pb->len);
+    if(cmp != 0) {
+        return cmp;
+    }
+    return (pa->len > pb->len) - (pa->len < pb->len);
+}
+
+static int extract_path_check(const char *path) {
+    const char *component = path;
+    for(const char *c = path;; c++) {
+        if(*c == '/' || *c == '\0') {
+            size_t len = c - component;
+            if(len == 0 || (len == 1 && component[0] == '.') || (len == 2 && component[0] == '.' && component[1] == '.')) {
+                return EINVAL;
+            }
+            component = c + 1;
+        }
+
+        if(*c == '\0') {
+            return 0;
+        }
+    }
+}
+
+int extract_plan_init(struct extract_plan *plan, PBO_ENTRY *const *entries, size_t count, int rootfd) {
+    *plan = (struct extract_plan) {
+        .rootfd = rootfd,
+    };
+
+    size_t pathslen = 0;
+    for(size_t i = 0; i < count; i++) {
+        pathslen += strlen(pbo_entry_path(entries[i])) + 1;
+    }
+
+    plan->paths = malloc(pathslen > 0 ? pathslen : 1);
+    plan->files = calloc(count > 0 ? count : 1, sizeof(struct extract_file));
+    if(plan->paths == NULL || plan->files == NULL) {
+        int status = errno;
+        extract_plan_destroy(plan);
+        return status;
+    }
+    plan->file_count = count;
+
+    size_t prefix_count = 0;
+    char *pos = plan->paths;
+    for(size_t i = 0; i < count; i++) {
+        struct extract_file *file = &plan->files[i];
+        file->ent = entries[i];
+        file->path = pos;
+        file->name = pos;
+        file->dir = EXTRACT_PLAN_ROOT;
+
+        for(const char *c = pbo_entry_path(file->ent);; c++) {
+            *pos = *c == PBO_PATH_SEPARATOR[0] ? '/' : *c;
+            if(*pos == '/') {
+                file->name = pos + 1;
+                prefix_count++;
+                plan->stats.naive_syscalls++; // stat() of the parent
+            }
+
+            if(*pos++ == '\0') {
+                break;
+            }
+        }
+
+        file->status = extract_path_check(file->path);
+        plan->stats.naive_syscalls++; // open() of the file
+    }
+
+    struct extract_prefix *prefixes = calloc(prefix_count > 0 ? prefix_count : 1, sizeof(struct extract_prefix));
+    if(prefixes == NULL) {
+        int status = errno;
+        extract_plan_destroy(plan);
+        return status;
+    }
+
+    prefix_count = 0;
+    for(size_t i = 0; i < count; i++) {
+        struct extract_file *file = &plan->files[i];
+        if(file->status != 0) {
+            continue;
+        }
+
+        for(const char *c = file->path; c < file->name; c++) {
+            if(*c == '/') {
+                prefixes[prefix_count++] = (struct extract_prefix) {
+                    .path = file->path,
+                    .len = c - file->path,
+                };
+            }
+        }
+    }
+
+    // parents sort before their children, so creating in order always works
+    qsort(prefixes, prefix_count, sizeof(struct extract_prefix), extract_prefix_compare);
+
+    size_t unique = 0, dirslen = 0;
+    for(size_t i = 0; i < prefix_count; i++) {
+        if(unique == 0 || extract_prefix_compare(&prefixes[unique - 1], &prefixes[i]) != 0) {
+            prefixes[unique++] = prefixes[i];
+            dirslen += prefixes[i].len + 1;
+        }
+    }
+
+    plan->dirs = calloc(unique > 0 ? unique : 1, sizeof(struct extract_dir));
+    plan->dirpaths = malloc(dirslen > 0 ? dirslen : 1);
+    if(plan->dirs == NULL || plan->dirpaths == NULL) {
+        int status = errno;
+        free(prefixes);
+        extract_plan_destroy(plan);
+        return status;
+    }
+    plan->dir_count = unique;
+
+    pos = plan->dirpaths;
+    for(size_t i = 0; i < unique; i++) {
+        memcpy(pos, prefixes[i].path, prefixes[i].len);
+        pos[prefixes[i].len] = '\0';
+
+        plan->dirs[i] = (struct extract_dir) {
+            .path = pos,
+            .fd = -1,
+        };
+        pos += prefixes[i].len + 1;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        struct extract_file *file = &plan->files[i];
+        if(file->status != 0 || file->name == file->path) {
+            continue;
+        }
+
+        struct extract_prefix parent = {
+            .path = file->path,
+            .len = file->name - 1 - file->path,
+        };
+        struct extract_prefix *found = bsearch(&parent, prefixes, unique, sizeof(struct extract_prefix), extract_prefix_compare);
+        file->dir = found - prefixes;
+    }
+
+    free(prefixes);
+
+    plan->stats.naive_syscalls += unique; // mkdir() of each directory once
+    return 0;
+}
+
+int extract_plan_prepare(struct extract_plan *plan, size_t *budget) {
+    for(size_t i = 0; i < plan->dir_count; i++) {
+        struct extract_dir *dir = &plan->dirs[i];
+
+        plan->stats.syscalls++;
+        pbo_count(PBO_COUNTER_MKDIR, 1);
+        if(mkdirat(plan->rootfd, dir->path, 00777) == 0) {
+            plan->stats.dirs_created++;
+        } else if(errno != EEXIST) {
+            dir->status = errno;
+            continue;
+        }
+
+        if(*budget > 0) {
+            plan->stats.syscalls++;
+            pbo_count(PBO_COUNTER_OPEN, 1);
+            dir->fd = openat(plan->rootfd, dir->path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+            if(dir->fd < 0) {
+                dir->status = errno;
+                continue;
+            }
+            (*budget)--;
+        }
+    }
+
+    return 0;
+}
+
+int extract_plan_target(struct extract_plan *plan, size_t index, int *dirfd, const char **name) {
+    struct extract_file *file = &plan->files[index];
+    if(file->status != 0) {
+        return file->status;
+    }
+
+    *dirfd = plan->rootfd;
+    *name = file->path;
+    if(file->dir == EXTRACT_PLAN_ROOT) {
+        return 0;
+    }
+
+    struct extract_dir *dir = &plan->dirs[file->dir];
+    if(dir->status != 0) {
+        return dir->status;
+    }
+
+    if(dir->fd >= 0) {
+        *dirfd = dir->fd;
+        *name = file->name;
+    }
+    return 0;
+}
+
+int extract_plan_extract(struct extract_plan *plan, size_t index, int pbofd) {
+    int dirfd;
+    const char *name;
+    int status = extract_plan_target(plan, index, &dirfd, &name);
+    if(status != 0) {
+        return status;
+    }
+
+    return pbo_entry_extract_at(plan->files[index].ent, pbofd, dirfd, name);
+}
+
+int extract_plan_extract_stream(struct extract_plan *plan, size_t index, FILE *pbofile) {
+    int dirfd;
+    const char *name;
+    int status = extract_plan_target(plan, index, &dirfd, &name);
+    if(status != 0) {
+        return status;
+    }
+
+    return pbo_entry_extract_stream(plan->files[index].ent, pbofile, dirfd, name);
+}
+
+void extract_plan_destroy(struct extract_plan *plan) {
+    for(size_t i = 0; i < plan->dir_count; i++) {
+        if(plan->dirs[i].fd >= 0) {
+            close(plan->dirs[i].fd);
+        }
+    }
+
+    free(plan->dirs);
+    free(plan->dirpaths);
+    free(plan->files);
+    free(plan->paths);
+}
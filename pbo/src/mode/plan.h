@@ -0,0 +1,74 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "../pbo.h"
+
+#define EXTRACT_PLAN_ROOT ((size_t) -1)
+
+struct extract_dir {
+    const char *path;
+    int fd;
+    int status;
+};
+
+struct extract_file {
+    PBO_ENTRY *ent;
+    const char *path; // relative to the root, '/'-separated
+    const char *name; // last component of path
+    size_t dir;
+    int status;
+};
+
+struct extract_plan_stats {
+    unsigned long dirs_created;
+    unsigned long syscalls;
+    unsigned long naive_syscalls;
+};
+
+/*
+ * An extraction plan maps a list of entries of a PBO to a parent directory in the
+ * set of directories it needs. The set is created once up front, and files
+ * are then opened relative to cached directory descriptors instead of
+ * walking and stat()ing their full path per entry.
+ */
+struct extract_plan {
+    int rootfd;
+
+    char *paths, *dirpaths;
+    struct extract_dir *dirs;
+    size_t dir_count;
+    struct extract_file *files;
+    size_t file_count;
+
+    struct extract_plan_stats stats;
+};
+
+int extract_plan_init(struct extract_plan *plan, PBO_ENTRY *const *entries, size_t count, int rootfd);
+/*
+ * Creates the directories of the plan and keeps up to *budget of them open,
+ * deducting what it used so several plans can share one budget.
+ */
+int extract_plan_prepare(struct extract_plan *plan, size_t *budget);
+// where file `index` is written: a directory descriptor and a name in it
+int extract_plan_target(struct extract_plan *plan, size_t index, int *dirfd, const char **name);
+int extract_plan_extract(struct extract_plan *plan, size_t index, int pbofd);
+int extract_plan_extract_stream(struct extract_plan *plan, size_t index, FILE *pbofile);
+void extract_plan_destroy(struct extract_plan *plan);
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+#include "../pbo.h"
+
+double mode_stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void mode_stats_init(struct mode_stats *stats, const struct mode_options *opts) {
+    *stats = (struct mode_stats) {
+        .enabled = opts->stats,
+        .json = opts->stats_json,
+    };
+
+    if(stats->enabled) {
+        pbo_counters_enable(true);
+        stats->start = mode_stats_now();
+    }
+}
+
+void mode_stats_phase(struct mode_stats *stats, const char *name) {
+    if(!stats->enabled) {
+        return;
+    }
+
+    double now = mode_stats_now();
+    if(stats->phase != NULL) {
+        stats->phase->secs += now - stats->phase_start;
+        stats->phase = NULL;
+    }
+    if(name == NULL) {
+        return;
+    }
+
+    for(size_t i = 0; i < stats->phase_count; i++) {
+        if(strcmp(stats->phases[i].name, name) == 0) {
+            stats->phase = &stats->phases[i];
+        }
+    }
+    if(stats->phase == NULL && stats->phase_count < MODE_STATS_MAX) {
+        stats->phase = &stats->phases[stats->phase_count++];
+        stats->phase->name = name;
+    }
+    stats->phase_start = now;
+}
+
+static struct mode_stats_value * mode_stats_slot(struct mode_stats *stats, const char *name) {
+    for(size_t i = 0; i < stats->value_count; i++) {
+        if(strcmp(stats->values[i].name, name) == 0) {
+            return &stats->values[i];
+        }
+    }
+    if(stats->value_count == MODE_STATS_MAX) {
+        return NULL;
+    }
+
+    struct mode_stats_value *value = &stats->values[stats->value_count++];
+    *value = (struct mode_stats_value) {
+        .name = name,
+    };
+    return value;
+}
+
+void mode_stats_value(struct mode_stats *stats, const char *name, unsigned long long value) {
+    struct mode_stats_value *slot = stats->enabled ? mode_stats_slot(stats, name) : NULL;
+    if(slot != NULL) {
+        slot->value = value;
+    }
+}
+
+void mode_stats_real(struct mode_stats *stats, const char *name, double value) {
+    struct mode_stats_value *slot = stats->enabled ? mode_stats_slot(stats, name) : NULL;
+    if(slot != NULL) {
+        slot->is_real = true;
+        slot->real = value;
+    }
+}
+
+void mode_stats_text(struct mode_stats *stats, const char *name, const char *text) {
+    struct mode_stats_value *slot = stats->enabled ? mode_stats_slot(stats, name) : NULL;
+    if(slot != NULL) {
+        slot->text = text;
+    }
+}
+
+void mode_stats_entry(struct mode_stats *stats, const char *path, double secs) {
+    if(!stats->enabled) {
+        return;
+    }
+
+    size_t count = stats->slowest_count;
+    if(count == MODE_STATS_SLOWEST && secs <= stats->slowest[count - 1].secs) {
+        return;
+    }
+
+    char *copy = strdup(path);
+    if(copy == NULL) {
+        return;
+    }
+
+    if(count == MODE_STATS_SLOWEST) {
+        free(stats->slowest[--count].path);
+    }
+
+    size_t i = count;
+    for(; i > 0 && stats->slowest[i - 1].secs < secs; i--) {
+        stats->slowest[i] = stats->slowest[i - 1];
+    }
+    stats->slowest[i] = (struct mode_stats_entry) {
+        .path = copy,
+        .secs = secs,
+    };
+    stats->slowest_count = count + 1;
+}
+
+void mode_json_string(FILE *file, const char *str) {
+    fputc('"', file);
+    for(const unsigned char *c = (const unsigned char *) str; *c != '\0'; c++) {
+        if(*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if(*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void mode_stats_print_json(struct mode_stats *stats, double total) {
+    fprintf(stderr, "{\"phases\":{");
+    for(size_t i = 0; i < stats->phase_count; i++) {
+        fprintf(stderr, "%s\"%s\":%.6f", i > 0 ? "," : "", stats->phases[i].name, stats->phases[i].secs);
+    }
+    fprintf(stderr, "},\"total\":%.6f,\"io\":{", total);
+    for(enum pbo_counter c = 0; c < PBO_COUNTER_MAX; c++) {
+        fprintf(stderr, "%s\"%s\":%llu", c > 0 ? "," : "", pbo_counter_name(c), pbo_counter_get(c));
+    }
+    fprintf(stderr, "},\"values\":{");
+    for(size_t i = 0; i < stats->value_count; i++) {
+        struct mode_stats_value *value = &stats->values[i];
+        fprintf(stderr, "%s\"%s\":", i > 0 ? "," : "", value->name);
+        if(value->text != NULL) {
+            mode_json_string(stderr, value->text);
+        } else if(value->is_real) {
+            fprintf(stderr, "%.3f", value->real);
+        } else {
+            fprintf(stderr, "%llu", value->value);
+        }
+    }
+    fprintf(stderr, "},\"slowest\":[");
+    for(size_t i = 0; i < stats->slowest_count; i++) {
+        fprintf(stderr, "%s{\"path\":", i > 0 ? "," : "");
+        mode_json_string(stderr, stats->slowest[i].path);
+        fprintf(stderr, ",\"seconds\":%.6f}", stats->slowest[i].secs);
+    }
+    fprintf(stderr, "]}\n");
+}
+
+static void mode_stats_print_name(const char *name) {
+    for(const char *c = name; *c != '\0'; c++) {
+        fputc(*c == '_' ? ' ' : *c, stderr);
+    }
+}
+
+static void mode_stats_print_human(struct mode_stats *stats, double total) {
+    fprintf(stderr, "time:");
+    for(size_t i = 0; i < stats->phase_count; i++) {
+        fprintf(stderr, " %s %.3f ms,", stats->phases[i].name, stats->phases[i].secs * 1e3);
+    }
+    fprintf(stderr, " total %.3f ms\n", total * 1e3);
+
+    fprintf(stderr, "io:");
+    for(enum pbo_counter c = 0; c < PBO_COUNTER_MAX; c++) {
+        fprintf(stderr, "%s %llu ", c > 0 ? "," : "", pbo_counter_get(c));
+        mode_stats_print_name(pbo_counter_name(c));
+    }
+    fputc('\n', stderr);
+
+    for(size_t i = 0; i < stats->value_count; i++) {
+        struct mode_stats_value *value = &stats->values[i];
+        mode_stats_print_name(value->name);
+        if(value->text != NULL) {
+            fprintf(stderr, ": %s\n", value->text);
+        } else if(value->is_real) {
+            fprintf(stderr, ": %.3f\n", value->real);
+        } else {
+            fprintf(stderr, ": %llu\n", value->value);
+        }
+    }
+
+    if(stats->slowest_count > 0) {
+        fprintf(stderr, "slowest entries:\n");
+    }
+    for(size_t i = 0; i < stats->slowest_count; i++) {
+        fprintf(stderr, "  %10.3f ms  %s\n", stats->slowest[i].secs * 1e3, stats->slowest[i].path);
+    }
+}
+
+void mode_stats_report(struct mode_stats *stats) {
+    if(!stats->enabled) {
+        return;
+    }
+
+    mode_stats_phase(stats, NULL);
+    double total = mode_stats_now() - stats->start;
+    if(stats->json) {
+        mode_stats_print_json(stats, total);
+    } else {
+        mode_stats_print_human(stats, total);
+    }
+
+    for(size_t i = 0; i < stats->slowest_count; i++) {
+        free(stats->slowest[i].path);
+    }
+    stats->slowest_count = 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "mode.h"
+
+#define MODE_STATS_MAX 16
+#define MODE_STATS_SLOWEST 10
+
+struct mode_stats_phase {
+    const char *name;
+    double secs;
+};
+
+struct mode_stats_value {
+    const char *name; // snake_case, for both output forms
+    const char *text; // shown instead of value if set
+    unsigned long long value;
+    bool is_real; // show real instead of value
+    double real;
+};
+
+struct mode_stats_entry {
+    char *path;
+    double secs;
+};
+
+/*
+ * What a mode reports with --stats: the time spent in each of its phases,
+ * the I/O counters of the library, mode specific values and the entries that
+ * took longest. Every call is a no-op unless stats were asked for, and it is
+ * only used from the thread running the mode.
+ */
+struct mode_stats {
+    bool enabled, json;
+    double start, phase_start;
+    struct mode_stats_phase *phase; // running phase
+
+    struct mode_stats_phase phases[MODE_STATS_MAX];
+    size_t phase_count;
+    struct mode_stats_value values[MODE_STATS_MAX];
+    size_t value_count;
+    struct mode_stats_entry slowest[MODE_STATS_SLOWEST]; // slowest first
+    size_t slowest_count;
+};
+
+double mode_stats_now(void);
+
+void mode_stats_init(struct mode_stats *stats, const struct mode_options *opts);
+
+/*
+ * Ends the running phase and starts the named one, or none if NULL. Time of
+ * a phase that runs more than once, as per archive phases do, adds up.
+ */
+void mode_stats_phase(struct mode_stats *stats, const char *name);
+
+void mode_stats_value(struct mode_stats *stats, const char *name, unsigned long long value);
+void mode_stats_real(struct mode_stats *stats, const char *name, double value); // for rates and ratios
+void mode_stats_text(struct mode_stats *stats, const char *name, const char *text);
+void mode_stats_entry(struct mode_stats *stats, const char *path, double secs);
+
+// prints to stderr and releases the stats
+void mode_stats_report(struct mode_stats *stats);
+
+// writes `str` as a quoted JSON string
+void mode_json_string(FILE *file, const char *str);
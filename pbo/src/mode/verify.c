@@ -0,0 +1,139 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inputs.h"
+#include "mode.h"
+#include "stats.h"
+#include "../pbo.h"
+#include "../pool/pool.h"
+
+struct verify_ctx {
+    struct mode_input *inputs;
+    int *results;
+    size_t *order;
+};
+
+static void verify_worker(void *arg, size_t i) {
+    struct verify_ctx *ctx = arg;
+    size_t index = ctx->order[i];
+
+    pbo_count(PBO_COUNTER_OPEN, 1);
+    FILE *file = strcmp(ctx->inputs[index].path, "-") == 0 ? stdin : fopen(ctx->inputs[index].path, "r");
+    if(file == NULL) {
+        ctx->results[index] = errno;
+        return;
+    }
+
+    ctx->results[index] = pbo_verify(file);
+    if(file != stdin) {
+        fclose(file);
+    }
+}
+
+static struct mode_input *verify_sort_inputs;
+
+static int verify_compare_size(const void *a, const void *b) {
+    size_t ia = *(const size_t *) a, ib = *(const size_t *) b;
+
+    off_t sa = verify_sort_inputs[ia].size, sb = verify_sort_inputs[ib].size;
+    if(sa != sb) {
+        return (sa < sb) - (sa > sb);
+    }
+    return (ia > ib) - (ia < ib);
+}
+
+int pbo_mode_verify(const char *const *paths, size_t count, const struct mode_options *opts) {
+    int status;
+
+    struct mode_stats stats;
+    mode_stats_init(&stats, opts);
+
+    mode_stats_phase(&stats, "collect");
+    struct mode_inputs inputs;
+    status = mode_inputs_collect(&inputs, paths, count);
+    if(status != 0) {
+        return status;
+    }
+
+    size_t *order = NULL;
+    int *results = NULL;
+    if(inputs.count > 0) {
+        order = malloc(inputs.count * sizeof(*order));
+        results = calloc(inputs.count, sizeof(*results));
+        if(order == NULL || results == NULL) {
+            status = errno;
+        }
+    }
+
+    mode_stats_phase(&stats, "verify");
+    double start = mode_stats_now();
+
+    if(status == 0 && inputs.count > 0) {
+        // largest first so one big archive does not trail behind the rest
+        for(size_t i = 0; i < inputs.count; i++) {
+            order[i] = i;
+        }
+        verify_sort_inputs = inputs.items;
+        qsort(order, inputs.count, sizeof(*order), verify_compare_size);
+
+        struct verify_ctx ctx = {
+            .inputs = inputs.items,
+            .results = results,
+            .order = order,
+        };
+        status = pool_run(opts->jobs, inputs.count, verify_worker, &ctx);
+    }
+
+    double secs = mode_stats_now() - start;
+    mode_stats_phase(&stats, NULL);
+
+    if(status == 0) {
+        off_t bytes = 0;
+        for(size_t i = 0; i < inputs.count; i++) {
+            const char *path = inputs.items[i].path;
+            if(results[i] == 0) {
+                printf("%s: OK\n", path);
+            } else if(results[i] == EBADMSG) {
+                printf("%s: FAILED\n", path);
+            } else {
+                error(0, results[i], "failed to verify %s", path);
+            }
+
+            // read errors take precedence over mismatches
+            if(results[i] != 0 && (status == 0 || status == EBADMSG)) {
+                status = results[i];
+            }
+            bytes += inputs.items[i].size;
+        }
+
+        mode_stats_text(&stats, "sha1", pbo_verify_impl());
+        mode_stats_value(&stats, "archives", inputs.count);
+        mode_stats_value(&stats, "bytes", bytes);
+        mode_stats_real(&stats, "mb_per_second", secs > 0 ? bytes / secs / 1e6 : 0);
+        mode_stats_report(&stats);
+    }
+
+    mode_inputs_destroy(&inputs);
+    free(results);
+    free(order);
+    return status;
+}
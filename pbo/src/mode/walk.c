@@ -0,0 +1,453 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "walk.h"
+#include "../pbo.h"
+#include "../pool/pool.h"
+
+struct pack_walk_dir {
+    char *path; // relative to the root, empty for the root itself
+    int status;
+
+    struct pack_file *files;
+    size_t file_count, file_capacity;
+    struct pack_file *dirs; // subdirectories, to be walked unless already seen
+    size_t dir_count, dir_capacity;
+};
+
+struct pack_walk_id {
+    dev_t dev;
+    ino_t ino;
+    bool link;
+    size_t index;
+};
+
+struct pack_walk_ctx {
+    int rootfd;
+    size_t rootlen;
+    struct pack_walk_dir *dirs;
+
+    struct pack_walk_id *seen; // directories walked or queued, by id
+    size_t seen_count;
+};
+
+static int pack_walk_add(struct pack_file **items, size_t *count, size_t *capacity, char *path, const struct stat *info, bool link) {
+    if(*count == *capacity) {
+        size_t grown = *capacity > 0 ? *capacity * 2 : 16;
+        struct pack_file *resized = realloc(*items, grown * sizeof(struct pack_file));
+        if(resized == NULL) {
+            return errno;
+        }
+        *items = resized;
+        *capacity = grown;
+    }
+
+    (*items)[(*count)++] = (struct pack_file) {
+        .path = path,
+        .info = *info,
+        .link = link,
+    };
+    return 0;
+}
+
+static int pack_walk_read(const struct pack_walk_ctx *ctx, struct pack_walk_dir *dir) {
+    int status;
+
+    pbo_count(PBO_COUNTER_OPEN, 1);
+    int fd = openat(ctx->rootfd, dir->path[0] != '\0' ? dir->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        return errno;
+    }
+
+    DIR *stream = fdopendir(fd);
+    if(stream == NULL) {
+        status = errno;
+        close(fd);
+        return status;
+    }
+
+    size_t pathlen = strlen(dir->path);
+    status = 0;
+    while(status == 0) {
+        errno = 0;
+        struct dirent *de = readdir(stream);
+        if(de == NULL) {
+            status = errno;
+            break;
+        }
+
+        const char *name = de->d_name;
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        size_t namelen = strlen(name);
+        if(ctx->rootlen + 1 + pathlen + 1 + namelen >= PATH_MAX) {
+            status = ENAMETOOLONG;
+            break;
+        }
+
+        char *path = malloc(pathlen + 1 + namelen + 1);
+        if(path == NULL) {
+            status = errno;
+            break;
+        }
+        size_t len = pathlen;
+        memcpy(path, dir->path, pathlen);
+        if(pathlen > 0) {
+            path[len++] = '/';
+        }
+        memcpy(path + len, name, namelen + 1);
+
+        struct stat info;
+        pbo_count(PBO_COUNTER_STAT, 1);
+        if(fstatat(fd, name, &info, 0) != 0) {
+            status = errno;
+            free(path);
+            break;
+        }
+
+        if(S_ISDIR(info.st_mode)) {
+            status = pack_walk_add(&dir->dirs, &dir->dir_count, &dir->dir_capacity, path, &info, de->d_type == DT_LNK);
+        } else if(S_ISREG(info.st_mode)) {
+            status = pack_walk_add(&dir->files, &dir->file_count, &dir->file_capacity, path, &info, de->d_type == DT_LNK);
+        } else {
+            free(path);
+            continue;
+        }
+
+        if(status != 0) {
+            free(path);
+        }
+    }
+
+    closedir(stream);
+    return status;
+}
+
+static void pack_walk_worker(void *arg, size_t index) {
+    struct pack_walk_ctx *ctx = arg;
+    ctx->dirs[index].status = pack_walk_read(ctx, &ctx->dirs[index]);
+}
+
+static void pack_walk_dir_destroy(struct pack_walk_dir *dir) {
+    for(size_t i = 0; i < dir->file_count; i++) {
+        free(dir->files[i].path);
+    }
+    for(size_t i = 0; i < dir->dir_count; i++) {
+        free(dir->dirs[i].path);
+    }
+    free(dir->files);
+    free(dir->dirs);
+    free(dir->path);
+}
+
+static int pack_fold(unsigned char c) {
+    if(c == '/') {
+        return PBO_PATH_SEPARATOR[0];
+    }
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static int pack_fold_compare(const char *a, const char *b) {
+    for(;; a++, b++) {
+        // sorted neighbours share long prefixes, which need no folding
+        if(*a == *b) {
+            if(*a == '\0') {
+                return 0;
+            }
+            continue;
+        }
+
+        int ca = pack_fold(*a), cb = pack_fold(*b);
+        if(ca != cb) {
+            return ca - cb;
+        }
+    }
+}
+
+// paths that differ only in case are ordered by their bytes, so every order is total
+static int pack_path_compare(const void *a, const void *b) {
+    const struct pack_file *fa = a, *fb = b;
+
+    int cmp = pack_fold_compare(fa->path, fb->path);
+    return cmp != 0 ? cmp : strcmp(fa->path, fb->path);
+}
+
+static const char * pack_extension(const char *path) {
+    const char *name = strrchr(path, '/');
+    const char *ext = strrchr(name != NULL ? name : path, '.');
+    return ext != NULL ? ext : "";
+}
+
+static int pack_type_compare(const void *a, const void *b) {
+    const struct pack_file *fa = a, *fb = b;
+
+    int cmp = pack_fold_compare(pack_extension(fa->path), pack_extension(fb->path));
+    return cmp != 0 ? cmp : pack_path_compare(a, b);
+}
+
+static int pack_size_compare(const void *a, const void *b) {
+    const struct pack_file *fa = a, *fb = b;
+
+    if(fa->info.st_size != fb->info.st_size) {
+        return fa->info.st_size < fb->info.st_size ? -1 : 1;
+    }
+    return pack_path_compare(a, b);
+}
+
+static int pack_walk_id_compare(const void *a, const void *b) {
+    const struct pack_walk_id *ia = a, *ib = b;
+
+    if(ia->dev != ib->dev) {
+        return ia->dev < ib->dev ? -1 : 1;
+    }
+    return (ia->ino > ib->ino) - (ia->ino < ib->ino);
+}
+
+static int pack_walk_id_order(const void *a, const void *b) {
+    const struct pack_walk_id *ia = a, *ib = b;
+
+    int cmp = pack_walk_id_compare(a, b);
+    if(cmp == 0) {
+        cmp = ia->link - ib->link;
+    }
+    return cmp != 0 ? cmp : (ia->index > ib->index) - (ia->index < ib->index);
+}
+
+/*
+ * Drops the directories of `dirs` that were walked already, or that appear
+ * more than once, keeping one not named by a link and then the first by
+ * path. Links to an ancestor or to a sibling would otherwise be walked again
+ * and again. The rest are added to the directories seen and kept in path
+ * order.
+ */
+static int pack_walk_unseen(struct pack_walk_ctx *ctx, struct pack_file *dirs, size_t *count) {
+    qsort(dirs, *count, sizeof(struct pack_file), pack_path_compare);
+
+    struct pack_walk_id *ids = malloc((*count > 0 ? *count : 1) * sizeof(struct pack_walk_id));
+    struct pack_walk_id *seen = realloc(ctx->seen, (ctx->seen_count + *count + 1) * sizeof(struct pack_walk_id));
+    if(seen != NULL) {
+        ctx->seen = seen;
+    }
+    if(ids == NULL || seen == NULL) {
+        free(ids);
+        return ENOMEM;
+    }
+
+    for(size_t i = 0; i < *count; i++) {
+        ids[i] = (struct pack_walk_id) {
+            .dev = dirs[i].info.st_dev,
+            .ino = dirs[i].info.st_ino,
+            .link = dirs[i].link,
+            .index = i,
+        };
+    }
+    qsort(ids, *count, sizeof(struct pack_walk_id), pack_walk_id_order);
+
+    size_t seen_count = ctx->seen_count;
+    for(size_t i = 0; i < *count; i++) {
+        bool repeat = i > 0 && pack_walk_id_compare(&ids[i - 1], &ids[i]) == 0;
+        if(repeat || bsearch(&ids[i], ctx->seen, ctx->seen_count, sizeof(struct pack_walk_id), pack_walk_id_compare) != NULL) {
+            free(dirs[ids[i].index].path);
+            dirs[ids[i].index].path = NULL;
+        } else {
+            ctx->seen[seen_count++] = ids[i];
+        }
+    }
+    free(ids);
+
+    ctx->seen_count = seen_count;
+    qsort(ctx->seen, ctx->seen_count, sizeof(struct pack_walk_id), pack_walk_id_compare);
+
+    size_t kept = 0;
+    for(size_t i = 0; i < *count; i++) {
+        if(dirs[i].path != NULL) {
+            dirs[kept++] = dirs[i];
+        }
+    }
+    *count = kept;
+    return 0;
+}
+
+/*
+ * Moves the files found on one level into the tree and returns the
+ * directories of the next one.
+ */
+static int pack_walk_collect(struct pack_walk_ctx *ctx, struct pack_tree *tree, struct pack_walk_dir *level, size_t count, struct pack_walk_dir **next, size_t *next_count) {
+    int status;
+
+    size_t files = 0, dirs = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(level[i].status != 0) {
+            return level[i].status;
+        }
+        files += level[i].file_count;
+        dirs += level[i].dir_count;
+    }
+
+    struct pack_file *merged = realloc(tree->files, (tree->file_count + files > 0 ? tree->file_count + files : 1) * sizeof(struct pack_file));
+    if(merged == NULL) {
+        return errno;
+    }
+    tree->files = merged;
+
+    struct pack_file *found = malloc((dirs > 0 ? dirs : 1) * sizeof(struct pack_file));
+    if(found == NULL) {
+        return errno;
+    }
+
+    dirs = 0;
+    for(size_t i = 0; i < count; i++) {
+        memcpy(tree->files + tree->file_count, level[i].files, level[i].file_count * sizeof(struct pack_file));
+        tree->file_count += level[i].file_count;
+        level[i].file_count = 0;
+
+        memcpy(found + dirs, level[i].dirs, level[i].dir_count * sizeof(struct pack_file));
+        dirs += level[i].dir_count;
+        level[i].dir_count = 0;
+    }
+
+    status = pack_walk_unseen(ctx, found, &dirs);
+    if(status == 0) {
+        *next = calloc(dirs > 0 ? dirs : 1, sizeof(struct pack_walk_dir));
+        status = *next == NULL ? errno : 0;
+    }
+    if(status != 0) {
+        for(size_t i = 0; i < dirs; i++) {
+            free(found[i].path);
+        }
+        free(found);
+        return status;
+    }
+
+    for(size_t i = 0; i < dirs; i++) {
+        (*next)[i].path = found[i].path;
+    }
+    *next_count = dirs;
+    free(found);
+    return 0;
+}
+
+// paths that PBO lookups could not tell apart
+static int pack_walk_check_case(const struct pack_tree *tree) {
+    for(size_t i = 1; i < tree->file_count; i++) {
+        if(pack_fold_compare(tree->files[i - 1].path, tree->files[i].path) == 0) {
+            error(0, 0, "%s and %s differ only in case", tree->files[i - 1].path, tree->files[i].path);
+            return EEXIST;
+        }
+    }
+    return 0;
+}
+
+int pack_tree_walk(struct pack_tree *tree, const char *dir, enum mode_order order, unsigned jobs) {
+    int status;
+
+    *tree = (struct pack_tree) { 0 };
+
+    pbo_count(PBO_COUNTER_OPEN, 1);
+    struct pack_walk_ctx ctx = {
+        .rootfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC),
+        .rootlen = strlen(dir),
+    };
+    if(ctx.rootfd < 0) {
+        return errno;
+    }
+
+    struct stat rootinfo;
+    size_t count = 1;
+    struct pack_walk_dir *level = calloc(1, sizeof(struct pack_walk_dir));
+    ctx.seen = malloc(sizeof(struct pack_walk_id));
+    if(fstat(ctx.rootfd, &rootinfo) != 0 || level == NULL || ctx.seen == NULL || (level->path = strdup("")) == NULL) {
+        status = errno;
+        free(level);
+        free(ctx.seen);
+        close(ctx.rootfd);
+        return status;
+    }
+    ctx.seen[ctx.seen_count++] = (struct pack_walk_id) {
+        .dev = rootinfo.st_dev,
+        .ino = rootinfo.st_ino,
+    };
+
+    // a level is read in parallel once the one above it has listed all its directories
+    status = 0;
+    while(count > 0) {
+        tree->dir_count += count;
+
+        ctx.dirs = level;
+        status = pool_run(jobs, count, pack_walk_worker, &ctx);
+
+        struct pack_walk_dir *next = NULL;
+        size_t next_count = 0;
+        if(status == 0) {
+            status = pack_walk_collect(&ctx, tree, level, count, &next, &next_count);
+        }
+
+        for(size_t i = 0; i < count; i++) {
+            pack_walk_dir_destroy(&level[i]);
+        }
+        free(level);
+
+        level = next;
+        count = next_count;
+        if(status != 0) {
+            break;
+        }
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        pack_walk_dir_destroy(&level[i]);
+    }
+    free(level);
+    free(ctx.seen);
+    close(ctx.rootfd);
+
+    if(status == 0) {
+        qsort(tree->files, tree->file_count, sizeof(struct pack_file), pack_path_compare);
+        status = pack_walk_check_case(tree);
+    }
+    if(status != 0) {
+        pack_tree_destroy(tree);
+        return status;
+    }
+
+    if(order == MODE_ORDER_TYPE) {
+        qsort(tree->files, tree->file_count, sizeof(struct pack_file), pack_type_compare);
+    } else if(order == MODE_ORDER_SIZE) {
+        qsort(tree->files, tree->file_count, sizeof(struct pack_file), pack_size_compare);
+    }
+    return 0;
+}
+
+void pack_tree_destroy(struct pack_tree *tree) {
+    for(size_t i = 0; i < tree->file_count; i++) {
+        free(tree->files[i].path);
+    }
+    free(tree->files);
+    *tree = (struct pack_tree) { 0 };
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "mode.h"
+
+struct pack_file {
+    char *path; // relative to the root, '/'-separated
+    struct stat info;
+    bool link; // named by a symbolic link
+};
+
+/*
+ * The regular files below a directory, for packing. Each level of the tree
+ * is read by a pool of threads, with directories opened relative to the
+ * root and their entries stat()ed relative to the directory. Symbolic links
+ * are followed, but a directory reachable by several paths is walked only
+ * under one: the shallowest, one not named by a link, and the first by
+ * path, in that order of preference. The files are then sorted the same way
+ * whatever the order of the directories on disk: by PBO path, compared
+ * byte-wise with ASCII case folded and '\' as the separator, or by
+ * extension or size first. Paths differing only in case fail with EEXIST.
+ */
+struct pack_tree {
+    struct pack_file *files;
+    size_t file_count;
+    size_t dir_count;
+};
+
+int pack_tree_walk(struct pack_tree *tree, const char *dir, enum mode_order order, unsigned jobs);
+void pack_tree_destroy(struct pack_tree *tree);
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+int mount_cache_init(struct mount_cache *cache, size_t capacity) {
+    *cache = (struct mount_cache) {
+        .capacity = capacity,
+    };
+    cache->lru.prev = cache->lru.next = &cache->lru;
+
+    size_t buckets = 16;
+    while(buckets < 2 * (capacity / MOUNT_BLOCK_SIZE)) {
+        buckets *= 2;
+    }
+
+    cache->buckets = calloc(buckets, sizeof(struct mount_block *));
+    if(cache->buckets == NULL) {
+        return errno;
+    }
+    cache->mask = buckets - 1;
+
+    int status = pthread_mutex_init(&cache->lock, NULL);
+    if(status != 0) {
+        free(cache->buckets);
+        return status;
+    }
+    return 0;
+}
+
+void mount_cache_destroy(struct mount_cache *cache) {
+    for(struct mount_block *block = cache->lru.next; block != &cache->lru;) {
+        struct mount_block *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(cache->buckets);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+static struct mount_block ** mount_cache_bucket(struct mount_cache *cache, size_t entry, size_t index) {
+    size_t hash = (entry * 0x9E3779B97F4A7C15ULL) ^ index;
+    return &cache->buckets[(hash ^ (hash >> 29)) & cache->mask];
+}
+
+static struct mount_block * mount_cache_find(struct mount_cache *cache, size_t entry, size_t index) {
+    for(struct mount_block *block = *mount_cache_bucket(cache, entry, index); block != NULL; block = block->chain) {
+        if(block->entry == entry && block->index == index) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+static void mount_cache_unlink(struct mount_block *block) {
+    block->prev->next = block->next;
+    block->next->prev = block->prev;
+}
+
+static void mount_cache_push(struct mount_cache *cache, struct mount_block *block) {
+    block->prev = &cache->lru;
+    block->next = cache->lru.next;
+    cache->lru.next->prev = block;
+    cache->lru.next = block;
+}
+
+static void mount_cache_evict(struct mount_cache *cache, struct mount_block *block) {
+    struct mount_block **link = mount_cache_bucket(cache, block->entry, block->index);
+    while(*link != block) {
+        link = &(*link)->chain;
+    }
+    *link = block->chain;
+
+    mount_cache_unlink(block);
+    cache->used -= block->len;
+    free(block);
+}
+
+bool mount_cache_get(struct mount_cache *cache, size_t entry, size_t index, size_t offset, void *buf, size_t len, size_t *copied) {
+    pthread_mutex_lock(&cache->lock);
+
+    struct mount_block *block = mount_cache_find(cache, entry, index);
+    if(block != NULL) {
+        mount_cache_unlink(block);
+        mount_cache_push(cache, block);
+
+        *copied = offset < block->len ? block->len - offset : 0;
+        if(*copied > len) {
+            *copied = len;
+        }
+        memcpy(buf, block->data + offset, *copied);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    return block != NULL;
+}
+
+void mount_cache_put(struct mount_cache *cache, size_t entry, size_t index, const void *data, size_t len) {
+    if(len > cache->capacity) {
+        return;
+    }
+
+    struct mount_block *block = malloc(sizeof(struct mount_block) + len);
+    if(block == NULL) {
+        return; // the cache is only an optimization
+    }
+    *block = (struct mount_block) {
+        .entry = entry,
+        .index = index,
+        .len = len,
+    };
+    memcpy(block->data, data, len);
+
+    pthread_mutex_lock(&cache->lock);
+
+    if(mount_cache_find(cache, entry, index) != NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        free(block);
+        return;
+    }
+
+    while(cache->used + len > cache->capacity) {
+        mount_cache_evict(cache, cache->lru.prev);
+    }
+
+    struct mount_block **bucket = mount_cache_bucket(cache, entry, index);
+    block->chain = *bucket;
+    *bucket = block;
+    mount_cache_push(cache, block);
+    cache->used += len;
+
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MOUNT_BLOCK_SIZE 65536
+
+struct mount_block {
+    size_t entry, index; // tree node of the entry, block number in the entry
+    size_t len;
+
+    struct mount_block *prev, *next; // most recently used first
+    struct mount_block *chain;
+
+    unsigned char data[];
+};
+
+/*
+ * Decompressed blocks of compressed entries, evicted least recently used
+ * first once they take up more than the capacity. Safe to use from several
+ * threads.
+ */
+struct mount_cache {
+    pthread_mutex_t lock;
+    size_t capacity, used;
+
+    struct mount_block **buckets;
+    size_t mask;
+    struct mount_block lru;
+};
+
+int mount_cache_init(struct mount_cache *cache, size_t capacity);
+void mount_cache_destroy(struct mount_cache *cache);
+
+/*
+ * Copies bytes from `offset` within a cached block into `buf`. Returns false
+ * if the block is not cached.
+ */
+bool mount_cache_get(struct mount_cache *cache, size_t entry, size_t index, size_t offset, void *buf, size_t len, size_t *copied);
+void mount_cache_put(struct mount_cache *cache, size_t entry, size_t index, const void *data, size_t len);
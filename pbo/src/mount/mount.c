@@ -0,0 +1,416 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define FUSE_USE_VERSION 31
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <fuse.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "tree.h"
+#include "../pbo.h"
+
+/*
+ * Serves a PBO as a read-only directory tree. Stored entries are read with
+ * pread() straight from the archive; compressed ones are decompressed on
+ * demand, a block at a time, into a cache shared by all open files.
+ */
+
+struct mount_ctx {
+    PBO *pbo;
+    int fd;
+    struct stat info;
+
+    struct mount_tree tree;
+    struct mount_cache cache;
+};
+
+static struct mount_ctx mount_ctx;
+
+/*
+ * An open compressed entry. Its reader is positioned at `pos` of the
+ * decompressed data, so reading the entry front to back decodes it once;
+ * going back to a block that has been evicted decodes it again from the
+ * start.
+ */
+struct mount_file {
+    pthread_mutex_t lock;
+    PBO_ENTRY *ent;
+    size_t index;
+
+    PBO_READER *reader;
+    size_t pos;
+    unsigned char block[MOUNT_BLOCK_SIZE];
+};
+
+static off_t mount_entry_size(PBO_ENTRY *ent) {
+    return pbo_entry_is_compressed(ent) ? pbo_entry_original_size(ent) : pbo_entry_data_size(ent);
+}
+
+static int mount_getattr(const char *path, struct stat *info, struct fuse_file_info *fi) {
+    (void) fi;
+
+    struct mount_node *node = mount_tree_lookup(&mount_ctx.tree, path);
+    if(node == NULL) {
+        return -ENOENT;
+    }
+
+    *info = (struct stat) {
+        .st_uid = mount_ctx.info.st_uid,
+        .st_gid = mount_ctx.info.st_gid,
+        .st_atim = mount_ctx.info.st_mtim,
+        .st_mtim = mount_ctx.info.st_mtim,
+        .st_ctim = mount_ctx.info.st_ctim,
+    };
+
+    if(node->ent == NULL) {
+        info->st_mode = S_IFDIR | 0555;
+        info->st_nlink = 2;
+        return 0;
+    }
+
+    info->st_mode = S_IFREG | 0444;
+    info->st_nlink = 1;
+    info->st_size = mount_entry_size(node->ent);
+    info->st_blocks = (pbo_entry_data_size(node->ent) + 511) / 512;
+    if(pbo_entry_timestamp(node->ent) != 0) {
+        info->st_mtim = (struct timespec) {
+            .tv_sec = pbo_entry_timestamp(node->ent),
+        };
+        info->st_atim = info->st_mtim;
+    }
+    return 0;
+}
+
+static int mount_open(const char *path, struct fuse_file_info *fi) {
+    int status;
+
+    struct mount_node *node = mount_tree_lookup(&mount_ctx.tree, path);
+    if(node == NULL) {
+        return -ENOENT;
+    } else if(node->ent == NULL) {
+        return -EISDIR;
+    } else if((fi->flags & O_ACCMODE) != O_RDONLY) {
+        return -EROFS;
+    }
+
+    // the archive does not change under the mount
+    fi->keep_cache = 1;
+    fi->fh = 0;
+    if(!pbo_entry_is_compressed(node->ent)) {
+        return 0;
+    }
+
+    struct mount_file *file = malloc(sizeof(struct mount_file));
+    if(file == NULL) {
+        return -errno;
+    }
+    *file = (struct mount_file) {
+        .ent = node->ent,
+        .index = node - mount_ctx.tree.nodes,
+    };
+
+    status = pthread_mutex_init(&file->lock, NULL);
+    if(status != 0) {
+        free(file);
+        return -status;
+    }
+
+    fi->fh = (uintptr_t) file;
+    return 0;
+}
+
+static int mount_release(const char *path, struct fuse_file_info *fi) {
+    (void) path;
+
+    struct mount_file *file = (struct mount_file *) (uintptr_t) fi->fh;
+    if(file != NULL) {
+        if(file->reader != NULL) {
+            pbo_reader_close(file->reader);
+        }
+        pthread_mutex_destroy(&file->lock);
+        free(file);
+    }
+    return 0;
+}
+
+static int mount_read_stored(PBO_ENTRY *ent, char *buf, size_t size, off_t offset) {
+    off_t len = pbo_entry_data_size(ent);
+    if(offset >= len) {
+        return 0;
+    }
+    if((off_t) size > len - offset) {
+        size = len - offset;
+    }
+
+    size_t done = 0;
+    while(done < size) {
+        ssize_t rlen = pread(mount_ctx.fd, buf + done, size - done, pbo_entry_offset(ent) + offset + done);
+        if(rlen < 0) {
+            return -errno;
+        } else if(rlen == 0) {
+            return -EIO;
+        }
+        done += rlen;
+    }
+    return done;
+}
+
+/*
+ * Decodes forward to block `index` of the file, caching every block passed
+ * on the way, and copies from it. Called with the file locked.
+ */
+static int mount_file_decode(struct mount_file *file, size_t index, size_t offset, char *buf, size_t len, size_t *copied) {
+    int status;
+
+    if(file->reader != NULL && file->pos > index * MOUNT_BLOCK_SIZE) {
+        pbo_reader_close(file->reader);
+        file->reader = NULL;
+    }
+    if(file->reader == NULL) {
+        status = pbo_entry_open(file->ent, mount_ctx.fd, &file->reader);
+        if(status != 0) {
+            return status;
+        }
+        file->pos = 0;
+    }
+
+    while(1) {
+        size_t filled = 0;
+        while(filled < MOUNT_BLOCK_SIZE) {
+            size_t rlen;
+            status = pbo_reader_read(file->reader, file->block + filled, MOUNT_BLOCK_SIZE - filled, &rlen);
+            if(status != 0) {
+                // the reader is in an unknown state, start over next time
+                pbo_reader_close(file->reader);
+                file->reader = NULL;
+                return status;
+            } else if(rlen == 0) {
+                break;
+            }
+            filled += rlen;
+        }
+
+        size_t current = file->pos / MOUNT_BLOCK_SIZE;
+        file->pos += filled;
+        if(filled > 0) {
+            mount_cache_put(&mount_ctx.cache, file->index, current, file->block, filled);
+        }
+
+        if(current == index || filled < MOUNT_BLOCK_SIZE) {
+            *copied = current == index && offset < filled ? filled - offset : 0;
+            if(*copied > len) {
+                *copied = len;
+            }
+            memcpy(buf, file->block + offset, *copied);
+            return 0;
+        }
+    }
+}
+
+static int mount_read_compressed(struct mount_file *file, char *buf, size_t size, off_t offset) {
+    int status;
+
+    off_t len = pbo_entry_original_size(file->ent);
+    if(offset >= len) {
+        return 0;
+    }
+    if((off_t) size > len - offset) {
+        size = len - offset;
+    }
+
+    size_t done = 0;
+    while(done < size) {
+        size_t index = (offset + done) / MOUNT_BLOCK_SIZE;
+        size_t within = (offset + done) % MOUNT_BLOCK_SIZE;
+
+        size_t copied;
+        if(!mount_cache_get(&mount_ctx.cache, file->index, index, within, buf + done, size - done, &copied)) {
+            pthread_mutex_lock(&file->lock);
+            status = mount_file_decode(file, index, within, buf + done, size - done, &copied);
+            pthread_mutex_unlock(&file->lock);
+            if(status != 0) {
+                return -status;
+            }
+        }
+
+        if(copied == 0) {
+            return -EIO; // the entry decoded to less than its size
+        }
+        done += copied;
+    }
+    return done;
+}
+
+static int mount_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    struct mount_file *file = (struct mount_file *) (uintptr_t) fi->fh;
+    if(file != NULL) {
+        return mount_read_compressed(file, buf, size, offset);
+    }
+
+    struct mount_node *node = mount_tree_lookup(&mount_ctx.tree, path);
+    if(node == NULL || node->ent == NULL) {
+        return -ENOENT;
+    }
+    return mount_read_stored(node->ent, buf, size, offset);
+}
+
+static int mount_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
+    (void) offset, (void) fi, (void) flags;
+
+    struct mount_node *node = mount_tree_lookup(&mount_ctx.tree, path);
+    if(node == NULL) {
+        return -ENOENT;
+    } else if(node->ent != NULL) {
+        return -ENOTDIR;
+    }
+
+    filler(buf, ".", NULL, 0, 0);
+    filler(buf, "..", NULL, 0, 0);
+
+    char name[PBO_PATH_MAX + 1];
+    for(uint32_t i = node->child; i != MOUNT_TREE_NONE; i = mount_ctx.tree.nodes[i].sibling) {
+        const struct mount_node *child = &mount_ctx.tree.nodes[i];
+        if(child->namelen > PBO_PATH_MAX) {
+            continue;
+        }
+
+        memcpy(name, child->path + child->pathlen - child->namelen, child->namelen);
+        name[child->namelen] = '\0';
+        if(filler(buf, name, NULL, 0, 0) != 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+static void * mount_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
+    (void) conn;
+
+    cfg->kernel_cache = 1;
+    cfg->entry_timeout = 3600;
+    cfg->attr_timeout = 3600;
+    cfg->negative_timeout = 3600;
+    return NULL;
+}
+
+static const struct fuse_operations mount_ops = {
+    .init = mount_init,
+    .getattr = mount_getattr,
+    .open = mount_open,
+    .read = mount_read,
+    .release = mount_release,
+    .readdir = mount_readdir,
+};
+
+struct mount_options {
+    const char *archive;
+    size_t cache_mb;
+};
+
+static const struct fuse_opt mount_opts[] = {
+    { "cache_size=%zu", offsetof(struct mount_options, cache_mb), 0 },
+    FUSE_OPT_END
+};
+
+static int mount_opt_proc(void *data, const char *arg, int key, struct fuse_args *args) {
+    (void) args;
+
+    struct mount_options *opts = data;
+    if(key == FUSE_OPT_KEY_NONOPT && opts->archive == NULL) {
+        opts->archive = arg;
+        return 0;
+    }
+    return 1;
+}
+
+static int mount_load(const char *path) {
+    int status;
+
+    FILE *file = fopen(path, "r");
+    if(file == NULL) {
+        return errno;
+    }
+
+    status = pbo_init(&mount_ctx.pbo);
+    if(status == 0) {
+        status = pbo_load(mount_ctx.pbo, file);
+    }
+    if(status == 0) {
+        mount_ctx.fd = dup(fileno(file));
+        if(mount_ctx.fd < 0 || fstat(mount_ctx.fd, &mount_ctx.info) != 0) {
+            status = errno;
+        }
+    }
+    fclose(file);
+
+    if(status == 0) {
+        status = mount_tree_build(&mount_ctx.tree, mount_ctx.pbo);
+    }
+    return status;
+}
+
+int main(int argc, char **argv) {
+    int status;
+
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct mount_options opts = {
+        .cache_mb = 64,
+    };
+    if(fuse_opt_parse(&args, &opts, mount_opts, mount_opt_proc) != 0) {
+        return 1;
+    }
+
+    if(opts.archive == NULL) {
+        fprintf(stderr, "usage: %s [options] ARCHIVE MOUNTPOINT\n", argv[0]);
+        fprintf(stderr, "    -o cache_size=MB       memory for decompressed blocks (default 64)\n");
+        fuse_opt_free_args(&args);
+        return 1;
+    }
+
+    // before fuse_main() may change directory
+    status = mount_load(opts.archive);
+    if(status != 0) {
+        error(0, status, "failed to load %s", opts.archive);
+        fuse_opt_free_args(&args);
+        return 1;
+    }
+
+    status = mount_cache_init(&mount_ctx.cache, opts.cache_mb << 20);
+    if(status != 0) {
+        error(0, status, "failed to set up the block cache");
+        fuse_opt_free_args(&args);
+        return 1;
+    }
+
+    status = fuse_main(args.argc, args.argv, &mount_ops, NULL);
+
+    mount_cache_destroy(&mount_ctx.cache);
+    mount_tree_destroy(&mount_ctx.tree);
+    close(mount_ctx.fd);
+    pbo_destroy(mount_ctx.pbo);
+    fuse_opt_free_args(&args);
+    return status;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+static uint32_t mount_tree_hash(const char *path, size_t len) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) path[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t * mount_tree_slot(const struct mount_tree *tree, const char *path, size_t len) {
+    for(size_t i = mount_tree_hash(path, len) & tree->mask;; i = (i + 1) & tree->mask) {
+        uint32_t *slot = &tree->slots[i];
+        if(*slot == 0) {
+            return slot;
+        }
+
+        const struct mount_node *node = &tree->nodes[*slot - 1];
+        if(node->pathlen == len && memcmp(node->path, path, len) == 0) {
+            return slot;
+        }
+    }
+}
+
+static uint32_t mount_tree_add(struct mount_tree *tree, uint32_t *slot, const char *path, size_t len, uint32_t parent, PBO_ENTRY *ent) {
+    const char *sep = memrchr(path, '/', len);
+    size_t namelen = sep != NULL ? (size_t) (path + len - sep - 1) : len;
+
+    uint32_t index = tree->count++;
+    tree->nodes[index] = (struct mount_node) {
+        .path = path,
+        .pathlen = len,
+        .namelen = namelen,
+        .ent = ent,
+        .child = MOUNT_TREE_NONE,
+        .sibling = tree->nodes[parent].child,
+    };
+    tree->nodes[parent].child = index;
+
+    *slot = index + 1;
+    return index;
+}
+
+static bool mount_tree_valid(const char *path, size_t len) {
+    const char *component = path;
+    for(const char *c = path; c <= path + len; c++) {
+        if(c == path + len || *c == '/') {
+            size_t clen = c - component;
+            if(clen == 0 || (clen == 1 && component[0] == '.') || (clen == 2 && component[0] == '.' && component[1] == '.')) {
+                return false;
+            }
+            component = c + 1;
+        }
+    }
+    return true;
+}
+
+static void mount_tree_insert(struct mount_tree *tree, char *path, PBO_ENTRY *ent) {
+    size_t len = strlen(path);
+    if(!mount_tree_valid(path, len)) {
+        return;
+    }
+
+    uint32_t parent = MOUNT_TREE_ROOT;
+    for(char *sep = strchr(path, '/'); sep != NULL; sep = strchr(sep + 1, '/')) {
+        size_t dirlen = sep - path;
+        uint32_t *slot = mount_tree_slot(tree, path, dirlen);
+        if(*slot == 0) {
+            parent = mount_tree_add(tree, slot, path, dirlen, parent, NULL);
+        } else if(tree->nodes[*slot - 1].ent == NULL) {
+            parent = *slot - 1;
+        } else {
+            return; // a file is in the way
+        }
+    }
+
+    uint32_t *slot = mount_tree_slot(tree, path, len);
+    if(*slot == 0) {
+        mount_tree_add(tree, slot, path, len, parent, ent);
+    } else if(tree->nodes[*slot - 1].ent != NULL) {
+        tree->nodes[*slot - 1].ent = ent;
+    }
+}
+
+int mount_tree_build(struct mount_tree *tree, PBO *pbo) {
+    *tree = (struct mount_tree) { 0 };
+
+    size_t count = pbo_get_entry_count(pbo);
+
+    // every entry and every separator in its path may add a node
+    size_t pathslen = 0, bound = 1;
+    for(size_t i = 0; i < count; i++) {
+        const char *path = pbo_entry_path(pbo_get_entry(pbo, i));
+        for(const char *c = path; *c != '\0'; c++) {
+            bound += *c == PBO_PATH_SEPARATOR[0] || *c == '/';
+        }
+        pathslen += strlen(path) + 1;
+        bound++;
+    }
+    if(bound >= UINT32_MAX / 2) {
+        return EOVERFLOW;
+    }
+
+    size_t slots = 16;
+    while(slots < bound * 2) {
+        slots *= 2;
+    }
+
+    tree->nodes = malloc(bound * sizeof(struct mount_node));
+    tree->paths = malloc(pathslen > 0 ? pathslen : 1);
+    tree->slots = calloc(slots, sizeof(uint32_t));
+    if(tree->nodes == NULL || tree->paths == NULL || tree->slots == NULL) {
+        int status = errno;
+        mount_tree_destroy(tree);
+        return status;
+    }
+    tree->capacity = bound;
+    tree->mask = slots - 1;
+
+    // the root is never looked up through the table
+    tree->nodes[MOUNT_TREE_ROOT] = (struct mount_node) {
+        .path = "",
+        .child = MOUNT_TREE_NONE,
+        .sibling = MOUNT_TREE_NONE,
+    };
+    tree->count = 1;
+
+    char *pos = tree->paths;
+    for(size_t i = 0; i < count; i++) {
+        PBO_ENTRY *ent = pbo_get_entry(pbo, i);
+
+        char *path = pos;
+        for(const char *c = pbo_entry_path(ent);; c++) {
+            *pos = *c == PBO_PATH_SEPARATOR[0] ? '/' : *c;
+            if(*pos++ == '\0') {
+                break;
+            }
+        }
+
+        mount_tree_insert(tree, path, ent);
+    }
+
+    return 0;
+}
+
+void mount_tree_destroy(struct mount_tree *tree) {
+    free(tree->nodes);
+    free(tree->paths);
+    free(tree->slots);
+    *tree = (struct mount_tree) { 0 };
+}
+
+struct mount_node * mount_tree_lookup(const struct mount_tree *tree, const char *path) {
+    while(*path == '/') {
+        path++;
+    }
+
+    size_t len = strlen(path);
+    if(len == 0) {
+        return &tree->nodes[MOUNT_TREE_ROOT];
+    }
+
+    uint32_t *slot = mount_tree_slot(tree, path, len);
+    return *slot != 0 ? &tree->nodes[*slot - 1] : NULL;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../pbo.h"
+
+#define MOUNT_TREE_ROOT 0
+#define MOUNT_TREE_NONE UINT32_MAX
+
+struct mount_node {
+    const char *path; // '/'-separated, not terminated; empty for the root
+    uint32_t pathlen, namelen; // the name is the last namelen bytes of path
+
+    PBO_ENTRY *ent; // NULL for directories
+    uint32_t child, sibling;
+};
+
+/*
+ * Directory tree of a PBO, built once from its entry table. Every path,
+ * whether of an entry or of a directory implied by one, is found through a
+ * hash table, and directories link their children, so lookups and listings
+ * never scan the entry list. The tree is not modified after it is built and
+ * may be read from any thread.
+ */
+struct mount_tree {
+    struct mount_node *nodes;
+    size_t count, capacity;
+    char *paths;
+
+    uint32_t *slots; // node index + 1, 0 if free
+    size_t mask;
+};
+
+/*
+ * Entries whose path cannot be represented, such as ones with empty, "." or
+ * ".." components or that collide with a directory, are left out. Of
+ * entries sharing a path, the last one is used, as when extracting.
+ */
+int mount_tree_build(struct mount_tree *tree, PBO *pbo);
+void mount_tree_destroy(struct mount_tree *tree);
+
+// `path` is absolute, as FUSE passes it
+struct mount_node * mount_tree_lookup(const struct mount_tree *tree, const char *path);
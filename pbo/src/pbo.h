@@ -16,29 +16,263 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #define PBO_PATH_MAX 260
 #define PBO_PATH_SEPARATOR "\\"
+#define PBO_DIGEST_SIZE 20
 
 typedef struct pbo_entry PBO_ENTRY;
 typedef struct pbo_property PBO_PROPERTY;
 typedef struct pbo PBO;
+typedef struct pbo_reader PBO_READER;
+typedef struct pbo_cache PBO_CACHE;
 
+/*
+ * A loaded PBO is not modified by reading it, so lookups, pbo_entry_read(),
+ * readers and extraction through descriptors may run from several threads at
+ * once. Adding to a PBO, saving it, and pbo_entry_extract(), which seeks the
+ * shared stream, need exclusive use.
+ */
 int pbo_init(PBO **pbo);
 int pbo_destroy(PBO *pbo);
 
+/*
+ * Loading fails with EIO unless the data of every entry lies within the
+ * file, so that reads later on need no range checks. Input from a pipe has
+ * no known size and is only found short when it is read.
+ */
 int pbo_load(PBO *pbo, FILE *file);
+int pbo_load_mmap(PBO *pbo, int fd);
 int pbo_save(PBO *pbo, FILE *file);
 
+struct pbo_scan_callbacks {
+    int (*property)(void *ctx, const char *key, const char *value);
+    int (*entry)(void *ctx, PBO_ENTRY *ent);
+};
+
+/*
+ * Parses the header at the current position of `fd` without loading it,
+ * passing each property and then each entry to the callbacks as it is read.
+ * Memory use is one read buffer however long the header is. Entries and
+ * strings are only valid during the call, and only the accessors that need
+ * neither the data nor neighbouring entries may be used on an entry. Either
+ * callback may be NULL, and one returning non-zero stops the scan with that
+ * status. If `fd` cannot seek, offsets are counted from the end of the
+ * header. Entries reaching past the end of the file fail with EIO when
+ * they are reached.
+ */
+int pbo_scan(int fd, const struct pbo_scan_callbacks *callbacks, void *ctx);
+
+/*
+ * Persistent cache of parsed headers, one file shared by any number of PBOs
+ * and keyed by their absolute path, size, modification time and inode. A
+ * PBO whose key still matches is loaded from the cache without opening it;
+ * any other is loaded with pbo_load_mmap() and its record replaced. A cache
+ * file that is missing, damaged or from another version starts out empty.
+ * Loads may run concurrently; new records are written out on close.
+ */
+int pbo_cache_open(PBO_CACHE **cache, const char *path);
+int pbo_cache_load(PBO_CACHE *cache, PBO *pbo, const char *path);
+int pbo_cache_close(PBO_CACHE *cache);
+
+/*
+ * Checks the SHA-1 trailer of a PBO by streaming the whole file through the
+ * hash. Returns EBADMSG if the trailer is missing or does not match.
+ */
+int pbo_verify(FILE *file);
+const char * pbo_verify_impl(void);
+
+/*
+ * Moves the file I/O of pbo_entries_extract_at() and of reading the inputs
+ * of pbo_save() onto io_uring, with up to `depth` files in flight per ring.
+ * Returns ENOSYS, leaving the blocking calls in use, if the library was
+ * built without it or the kernel refuses it. A depth of 0 turns it off.
+ */
+int pbo_io_uring(unsigned depth);
+
+/*
+ * How extraction and copies between PBOs treat the machine they run on.
+ * With `drop_cache` set, ranges of PBOs are read with sequential readahead
+ * hints, and both they and the files written are dropped from the page
+ * cache once done, so that a bulk run does not evict the data of other
+ * programs; batching through io_uring is then skipped. `buffer_size` sets
+ * the size of copy buffers and chunks, from 64 KiB to 1 GiB, rounded
+ * down to a multiple of 64 KiB (0 for the default of 1 MiB). `bandwidth`
+ * caps the bytes written per second by all threads together, 0 for none.
+ */
+struct pbo_io_policy {
+    bool drop_cache;
+    size_t buffer_size;
+    unsigned long long bandwidth;
+};
+
+int pbo_io_policy(const struct pbo_io_policy *policy);
+
+/*
+ * Drops the whole of `fd` from the page cache under a `drop_cache` policy,
+ * first waiting for its pending writes, and does nothing otherwise. Small
+ * entries share pages with their neighbours, so callers done with a PBO
+ * should release it to drop what extraction had to leave behind. Extracted
+ * files start being written back when closed and are dropped in batches,
+ * the last of which is dropped here.
+ */
+void pbo_io_release(int fd);
+
+/*
+ * Counts of the I/O done through the library, for finding out where the time
+ * of an operation goes. Counting is off until enabled, and then costs a
+ * relaxed atomic add per call site. Callers doing their own I/O around the
+ * library may add to the same counters.
+ */
+enum pbo_counter {
+    PBO_COUNTER_OPEN,
+    PBO_COUNTER_STAT,
+    PBO_COUNTER_MKDIR,
+    PBO_COUNTER_SEEK,
+    PBO_COUNTER_READ,
+    PBO_COUNTER_WRITE,
+    PBO_COUNTER_BYTES_READ,
+    PBO_COUNTER_BYTES_WRITTEN,
+    PBO_COUNTER_MAX,
+};
+
+void pbo_counters_enable(bool enable);
+void pbo_count(enum pbo_counter counter, unsigned long long n);
+unsigned long long pbo_counter_get(enum pbo_counter counter);
+const char * pbo_counter_name(enum pbo_counter counter);
+
+int pbo_add_property(PBO *pbo, const char *key, const char *value);
+
+/*
+ * Adds an entry whose data is read from the file at `source` when the PBO
+ * is saved. `info` describes the source; it is stat()ed if NULL.
+ */
+int pbo_add_entry(PBO *pbo, const char *path, const char *source, const struct stat *info);
+
+/*
+ * Compresses the data of an added entry in memory at the given effort level
+ * (1-12). The entry is left stored as is if compression does not make it
+ * smaller, or if it already takes its data from elsewhere. Different entries
+ * may be compressed concurrently.
+ */
+int pbo_entry_compress(PBO_ENTRY *ent, int level);
+
+/*
+ * Makes an added entry take the data of `from` as stored, for updating an
+ * archive without rewriting unchanged entries. `from` must belong to a PBO
+ * loaded with pbo_load_mmap() that stays loaded, with its descriptor open,
+ * until this PBO is saved. Saving then copies the data between descriptors
+ * where possible.
+ */
+int pbo_entry_reuse(PBO_ENTRY *ent, PBO_ENTRY *from);
+
 const char * pbo_property_key(PBO_PROPERTY *prop);
 const char * pbo_property_value(PBO_PROPERTY *prop);
 PBO_PROPERTY * pbo_property_next(PBO_PROPERTY *prop);
 
 const char * pbo_entry_path(PBO_ENTRY *ent);
 PBO_ENTRY * pbo_entry_next(PBO_ENTRY *ent);
+off_t pbo_entry_data_size(PBO_ENTRY *ent);
+off_t pbo_entry_offset(PBO_ENTRY *ent); // of the data within the PBO file
+
+/*
+ * Only available for PBOs loaded with pbo_load_mmap(); the data is a view
+ * into the mapping and stays valid until pbo_destroy().
+ */
+int pbo_entry_data(PBO_ENTRY *ent, const void **data, size_t *len);
 
 int pbo_entry_extract(PBO_ENTRY *ent, FILE *pbofile);
 
+/*
+ * Reads entry data with pread(), so concurrent extraction of different
+ * entries from one descriptor is safe.
+ */
+int pbo_entry_extract_fd(PBO_ENTRY *ent, int pbofd);
+
+/*
+ * Writes the entry to `name` relative to `dirfd` without creating any
+ * directories, for callers that lay out the output tree themselves. Files
+ * are stamped with the entry timestamp when it is set.
+ */
+int pbo_entry_extract_at(PBO_ENTRY *ent, int pbofd, int dirfd, const char *name);
+
+struct pbo_extract_request {
+    PBO_ENTRY *ent;
+    int pbofd, dirfd;
+    const char *name;
+    int status; // set on return
+};
+
+/*
+ * pbo_entry_extract_at() for many entries at once, which may come from
+ * different PBOs. With io_uring enabled, small stored entries are written in
+ * batches of linked open, read, write and close requests; other entries,
+ * any whose batch request failed and any left after the ring itself failed
+ * are extracted one by one. Returns an error only if the batch could not be
+ * run at all.
+ */
+int pbo_entries_extract_at(struct pbo_extract_request *requests, size_t count);
+
+/*
+ * Like pbo_entry_extract_at(), but reads the data from the current position
+ * of `pbofile` onward, which must be the start of the entry data. The stream
+ * is left at the end of the entry, so input that cannot seek can be
+ * extracted in one forward pass in offset order.
+ */
+int pbo_entry_extract_stream(PBO_ENTRY *ent, FILE *pbofile, int dirfd, const char *name);
+
+/*
+ * SHA-1 of the entry data as stored in the PBO, read with pread() unless the
+ * PBO is mapped.
+ */
+int pbo_entry_hash(PBO_ENTRY *ent, int pbofd, unsigned char digest[PBO_DIGEST_SIZE]);
+
+/*
+ * Reads up to `len` bytes of the entry contents at `offset`, decompressed,
+ * without temporary files. Only pread() on `pbofd` is used, or the mapping
+ * of a mapped PBO, so any number of threads may read from one loaded PBO
+ * at once. Fewer bytes are returned only at the end of the entry. Reading a
+ * compressed entry decodes it from the start, so use a reader to go through
+ * one in order.
+ */
+int pbo_entry_read(PBO_ENTRY *ent, int pbofd, void *buf, size_t len, off_t offset, size_t *rlen);
+
+/*
+ * Opens the entry for reading its contents from the start, decompressing as
+ * it goes, with pread() on `pbofd`. Readers of different entries, or of the
+ * same entry, are independent of each other. A read returns 0 bytes at the
+ * end of the entry.
+ */
+int pbo_entry_open(PBO_ENTRY *ent, int pbofd, PBO_READER **reader);
+int pbo_reader_read(PBO_READER *reader, void *buf, size_t len, size_t *rlen);
+void pbo_reader_close(PBO_READER *reader);
+
+time_t pbo_entry_timestamp(PBO_ENTRY *ent);
+bool pbo_entry_is_compressed(PBO_ENTRY *ent);
+off_t pbo_entry_original_size(PBO_ENTRY *ent);
+
 PBO_ENTRY * pbo_get_entries(PBO *pbo);
 PBO_PROPERTY * pbo_get_properties(PBO *pbo);
+
+/*
+ * Entries and properties are stored contiguously in header order, so index
+ * based access is O(1).
+ */
+size_t pbo_get_entry_count(PBO *pbo);
+PBO_ENTRY * pbo_get_entry(PBO *pbo, size_t index);
+size_t pbo_get_property_count(PBO *pbo);
+PBO_PROPERTY * pbo_get_property(PBO *pbo, size_t index);
+
+// position right after the header, where the data of a loaded PBO starts
+off_t pbo_get_data_offset(PBO *pbo);
+
+/*
+ * Looks up an entry by path, ignoring case and treating '/' and '\' alike.
+ * A hash index is built on the first call, which may come from several
+ * threads at once. Returns NULL with errno set if no entry matches.
+ */
+PBO_ENTRY * pbo_find_entry(PBO *pbo, const char *path);
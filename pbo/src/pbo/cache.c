@@ -0,0 +1,682 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pbofile.h"
+
+/*
+ * The cache file is a header, an array of keys sorted by path, and for each
+ * key its path and a body holding the entry and property tables and their
+ * strings. Everything is in host byte order and 8-byte aligned, so a mapped
+ * file is used in place; a file written on another kind of host, or by
+ * another version, is ignored and rewritten.
+ */
+
+#define PBO_CACHE_MAGIC "PBOHDRC"
+#define PBO_CACHE_VERSION 1
+#define PBO_CACHE_BYTE_ORDER 0x01020304u
+#define PBO_CACHE_NO_PATH UINT32_MAX
+
+struct pbo_cache_file {
+    char magic[8];
+    uint32_t version, byte_order;
+    uint64_t count;
+    uint64_t size; // of the whole file, so a truncated one is not used
+};
+
+struct pbo_cache_key {
+    uint64_t path, pathlen; // offset in the file, length without the terminator
+    uint64_t size, ino, dev;
+    int64_t mtime_sec, mtime_nsec;
+    uint64_t body, body_size;
+};
+
+struct pbo_cache_body {
+    uint64_t entry_count, property_count;
+    uint64_t data_offset;
+    uint64_t strings_size;
+};
+
+struct pbo_cache_entry {
+    uint32_t path; // offset in the strings
+    uint32_t type;
+    uint64_t original_size, offset;
+    int64_t timestamp;
+    uint64_t data_size;
+};
+
+struct pbo_cache_property {
+    uint32_t key, value;
+};
+
+// a record made during this run, written out on close
+struct pbo_cache_record {
+    char *path;
+    size_t seq;
+    struct pbo_cache_key key;
+    void *body;
+};
+
+struct pbo_cache {
+    char *path;
+    char *cwd;
+
+    const char *map;
+    size_t map_size;
+    const struct pbo_cache_key *keys;
+    size_t count;
+
+    pthread_mutex_t lock;
+    struct pbo_cache_record *records;
+    size_t record_count, record_capacity;
+
+    bool *used; // keys whose archive was seen, so it need not be checked on close
+};
+
+static size_t pbo_cache_align(size_t size) {
+    return (size + 7) & ~(size_t) 7;
+}
+
+static bool pbo_cache_range(const struct pbo_cache *cache, uint64_t offset, uint64_t len) {
+    return offset <= cache->map_size && len <= cache->map_size - offset;
+}
+
+static bool pbo_cache_valid(const struct pbo_cache *cache) {
+    const struct pbo_cache_file *file = (const struct pbo_cache_file *) cache->map;
+    if( cache->map_size < sizeof(struct pbo_cache_file) ||
+        memcmp(file->magic, PBO_CACHE_MAGIC, sizeof(file->magic)) != 0 ||
+        file->version != PBO_CACHE_VERSION ||
+        file->byte_order != PBO_CACHE_BYTE_ORDER ||
+        file->size != cache->map_size ||
+        file->count > (cache->map_size - sizeof(struct pbo_cache_file)) / sizeof(struct pbo_cache_key)) {
+
+        return false;
+    }
+
+    // keys are checked once here so that lookups can trust them
+    const struct pbo_cache_key *keys = (const struct pbo_cache_key *) (file + 1);
+    for(size_t i = 0; i < file->count; i++) {
+        if( !pbo_cache_range(cache, keys[i].path, keys[i].pathlen + 1) ||
+            cache->map[keys[i].path + keys[i].pathlen] != '\0' ||
+            !pbo_cache_range(cache, keys[i].body, keys[i].body_size) ||
+            keys[i].body % 8 != 0) {
+
+            return false;
+        }
+        if(i > 0 && strcmp(cache->map + keys[i - 1].path, cache->map + keys[i].path) >= 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int pbo_cache_map(struct pbo_cache *cache) {
+    int fd = open(cache->path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        // nothing cached yet
+        return errno == ENOENT ? 0 : errno;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) != 0) {
+        int status = errno;
+        close(fd);
+        return status;
+    }
+
+    if(info.st_size > 0) {
+        void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED) {
+            int status = errno;
+            close(fd);
+            return status;
+        }
+        cache->map = map;
+        cache->map_size = info.st_size;
+    }
+    close(fd);
+
+    if(cache->map != NULL && pbo_cache_valid(cache)) {
+        cache->keys = (const struct pbo_cache_key *) (cache->map + sizeof(struct pbo_cache_file));
+        cache->count = ((const struct pbo_cache_file *) cache->map)->count;
+    }
+    return 0;
+}
+
+int pbo_cache_open(struct pbo_cache **cache_ptr, const char *path) {
+    int status;
+
+    struct pbo_cache *cache = calloc(1, sizeof(struct pbo_cache));
+    if(cache == NULL) {
+        return errno;
+    }
+
+    cache->path = strdup(path);
+    cache->cwd = getcwd(NULL, 0);
+    if(cache->path == NULL || cache->cwd == NULL) {
+        status = errno;
+        free(cache->path);
+        free(cache->cwd);
+        free(cache);
+        return status;
+    }
+
+    status = pthread_mutex_init(&cache->lock, NULL);
+    if(status == 0) {
+        status = pbo_cache_map(cache);
+    }
+    if(status == 0 && cache->count > 0) {
+        cache->used = calloc(cache->count, sizeof(bool));
+        if(cache->used == NULL) {
+            status = errno;
+        }
+    }
+    if(status != 0) {
+        if(cache->map != NULL) {
+            munmap((void *) cache->map, cache->map_size);
+        }
+        free(cache->path);
+        free(cache->cwd);
+        free(cache);
+        return status;
+    }
+
+    *cache_ptr = cache;
+    return 0;
+}
+
+static const struct pbo_cache_key * pbo_cache_find(const struct pbo_cache *cache, const char *path) {
+    size_t lo = 0, hi = cache->count;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(path, cache->map + cache->keys[mid].path);
+        if(cmp == 0) {
+            return &cache->keys[mid];
+        } else if(cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+static bool pbo_cache_current(const struct pbo_cache_key *key, const struct stat *info) {
+    return  key->size == (uint64_t) info->st_size &&
+            key->ino == (uint64_t) info->st_ino &&
+            key->dev == (uint64_t) info->st_dev &&
+            key->mtime_sec == info->st_mtim.tv_sec &&
+            key->mtime_nsec == info->st_mtim.tv_nsec;
+}
+
+static struct pbo_cache_key pbo_cache_key_of(const struct stat *info) {
+    return (struct pbo_cache_key) {
+        .size = info->st_size,
+        .ino = info->st_ino,
+        .dev = info->st_dev,
+        .mtime_sec = info->st_mtim.tv_sec,
+        .mtime_nsec = info->st_mtim.tv_nsec,
+    };
+}
+
+/*
+ * Fills the tables of an empty PBO from a cached body. The tables and
+ * strings share one arena, as for a PBO loaded with pbo_load(). Returns
+ * EBADMSG for a body that does not hold together, including entries that
+ * reach past the `size` of the archive.
+ */
+static int pbo_cache_restore(struct pbo *pbo, const char *body, size_t body_size, uint64_t size) {
+    if(body_size < sizeof(struct pbo_cache_body)) {
+        return EBADMSG;
+    }
+
+    const struct pbo_cache_body *head = (const struct pbo_cache_body *) body;
+    size_t avail = (body_size - sizeof(struct pbo_cache_body));
+    if( head->entry_count > avail / sizeof(struct pbo_cache_entry) ||
+        head->property_count > (avail - head->entry_count * sizeof(struct pbo_cache_entry)) / sizeof(struct pbo_cache_property) ||
+        head->strings_size != avail - head->entry_count * sizeof(struct pbo_cache_entry) - head->property_count * sizeof(struct pbo_cache_property) ||
+        (head->strings_size > 0 && body[body_size - 1] != '\0')) {
+
+        return EBADMSG;
+    }
+
+    const struct pbo_cache_entry *entries = (const struct pbo_cache_entry *) (head + 1);
+    const struct pbo_cache_property *properties = (const struct pbo_cache_property *) (entries + head->entry_count);
+    const char *strings = (const char *) (properties + head->property_count);
+
+    size_t tables_size = (head->entry_count + 1) * sizeof(struct pbo_entry) + (head->property_count + 1) * sizeof(struct pbo_property);
+    char *arena = calloc(1, tables_size + head->strings_size);
+    if(arena == NULL) {
+        return errno;
+    }
+    pbo->arena = arena;
+
+    char *copy = arena + tables_size;
+    memcpy(copy, strings, head->strings_size);
+
+    pbo->entries = (struct pbo_entry *) arena;
+    pbo->entry_count = head->entry_count;
+    pbo->properties = (struct pbo_property *) (pbo->entries + head->entry_count + 1);
+    pbo->property_count = head->property_count;
+    pbo->data_offset = head->data_offset;
+
+    for(size_t i = 0; i < head->entry_count; i++) {
+        const struct pbo_cache_entry *cent = &entries[i];
+        if( (cent->path != PBO_CACHE_NO_PATH && cent->path >= head->strings_size) || cent->type > PBO_ENTRY_CPRS ||
+            cent->offset > size || cent->data_size > size - cent->offset) {
+
+            return EBADMSG;
+        }
+
+        pbo->entries[i] = (struct pbo_entry) {
+            .path = cent->path != PBO_CACHE_NO_PATH ? copy + cent->path : NULL,
+            .type = cent->type,
+            .original_size = cent->original_size,
+            .offset = cent->offset,
+            .timestamp = cent->timestamp,
+            .data_size = cent->data_size,
+        };
+    }
+
+    for(size_t i = 0; i < head->property_count; i++) {
+        if(properties[i].key >= head->strings_size || properties[i].value >= head->strings_size) {
+            return EBADMSG;
+        }
+
+        pbo->properties[i] = (struct pbo_property) {
+            .key = copy + properties[i].key,
+            .value = copy + properties[i].value,
+        };
+    }
+
+    return 0;
+}
+
+static int pbo_cache_string(char *strings, size_t *used, size_t size, const char *str, uint32_t *offset) {
+    if(str == NULL) {
+        *offset = PBO_CACHE_NO_PATH;
+        return 0;
+    }
+
+    size_t len = strlen(str) + 1;
+    if(*used > UINT32_MAX - 1 || len > size - *used) {
+        return EOVERFLOW;
+    }
+
+    memcpy(strings + *used, str, len);
+    *offset = *used;
+    *used += len;
+    return 0;
+}
+
+// the body for a loaded PBO, padded to a multiple of 8 bytes
+static int pbo_cache_serialize(struct pbo *pbo, void **body_ptr, size_t *body_size) {
+    int status;
+
+    size_t strings_size = 0;
+    for(size_t i = 0; i < pbo->entry_count; i++) {
+        if(pbo->entries[i].path != NULL) {
+            strings_size += strlen(pbo->entries[i].path) + 1;
+        }
+    }
+    for(size_t i = 0; i < pbo->property_count; i++) {
+        strings_size += strlen(pbo->properties[i].key) + 1 + strlen(pbo->properties[i].value) + 1;
+    }
+
+    size_t tables_size = sizeof(struct pbo_cache_body) + pbo->entry_count * sizeof(struct pbo_cache_entry) + pbo->property_count * sizeof(struct pbo_cache_property);
+    size_t size = pbo_cache_align(tables_size + strings_size);
+    char *body = calloc(1, size);
+    if(body == NULL) {
+        return errno;
+    }
+
+    // padding goes in the strings, which then still end in a terminator
+    struct pbo_cache_body *head = (struct pbo_cache_body *) body;
+    *head = (struct pbo_cache_body) {
+        .entry_count = pbo->entry_count,
+        .property_count = pbo->property_count,
+        .data_offset = pbo->data_offset,
+        .strings_size = size - tables_size,
+    };
+
+    struct pbo_cache_entry *entries = (struct pbo_cache_entry *) (head + 1);
+    struct pbo_cache_property *properties = (struct pbo_cache_property *) (entries + pbo->entry_count);
+    char *strings = (char *) (properties + pbo->property_count);
+
+    size_t used = 0;
+    for(size_t i = 0; i < pbo->entry_count; i++) {
+        const struct pbo_entry *ent = &pbo->entries[i];
+        entries[i] = (struct pbo_cache_entry) {
+            .type = ent->type,
+            .original_size = ent->original_size,
+            .offset = ent->offset,
+            .timestamp = ent->timestamp,
+            .data_size = ent->data_size,
+        };
+
+        status = pbo_cache_string(strings, &used, strings_size, ent->path, &entries[i].path);
+        if(status != 0) {
+            free(body);
+            return status;
+        }
+    }
+    for(size_t i = 0; i < pbo->property_count; i++) {
+        status = pbo_cache_string(strings, &used, strings_size, pbo->properties[i].key, &properties[i].key);
+        if(status == 0) {
+            status = pbo_cache_string(strings, &used, strings_size, pbo->properties[i].value, &properties[i].value);
+        }
+        if(status != 0) {
+            free(body);
+            return status;
+        }
+    }
+
+    *body_ptr = body;
+    *body_size = size;
+    return 0;
+}
+
+static int pbo_cache_add(struct pbo_cache *cache, const char *path, const struct stat *info, struct pbo *pbo) {
+    int status;
+
+    struct pbo_cache_record record = {
+        .key = pbo_cache_key_of(info),
+    };
+    status = pbo_cache_serialize(pbo, &record.body, &record.key.body_size);
+    if(status != 0) {
+        return status;
+    }
+
+    record.path = strdup(path);
+    if(record.path == NULL) {
+        status = errno;
+        free(record.body);
+        return status;
+    }
+    record.key.pathlen = strlen(path);
+
+    pthread_mutex_lock(&cache->lock);
+    if(cache->record_count == cache->record_capacity) {
+        size_t capacity = cache->record_capacity > 0 ? cache->record_capacity * 2 : 64;
+        struct pbo_cache_record *records = realloc(cache->records, capacity * sizeof(struct pbo_cache_record));
+        if(records == NULL) {
+            status = errno;
+        } else {
+            cache->records = records;
+            cache->record_capacity = capacity;
+        }
+    }
+    if(status == 0) {
+        record.seq = cache->record_count;
+        cache->records[cache->record_count++] = record;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if(status != 0) {
+        free(record.path);
+        free(record.body);
+    }
+    return status;
+}
+
+// the cache is keyed by absolute path, so it can be shared between directories
+static char * pbo_cache_absolute(const struct pbo_cache *cache, const char *path) {
+    if(*path == '/') {
+        return strdup(path);
+    }
+
+    size_t cwdlen = strlen(cache->cwd), pathlen = strlen(path);
+    char *abs = malloc(cwdlen + 1 + pathlen + 1);
+    if(abs != NULL) {
+        memcpy(abs, cache->cwd, cwdlen);
+        abs[cwdlen] = '/';
+        memcpy(abs + cwdlen + 1, path, pathlen + 1);
+    }
+    return abs;
+}
+
+int pbo_cache_load(struct pbo_cache *cache, struct pbo *pbo, const char *path) {
+    int status;
+
+    if(pbo->arena != NULL) {
+        return EBUSY;
+    }
+
+    char *abs = pbo_cache_absolute(cache, path);
+    if(abs == NULL) {
+        return errno;
+    }
+
+    const struct pbo_cache_key *key = pbo_cache_find(cache, abs);
+    if(key != NULL) {
+        pthread_mutex_lock(&cache->lock);
+        cache->used[key - cache->keys] = true;
+        pthread_mutex_unlock(&cache->lock);
+
+        struct stat info;
+        pbo_count(PBO_COUNTER_STAT, 1);
+        if(stat(path, &info) != 0) {
+            status = errno;
+            free(abs);
+            return status;
+        }
+
+        if(pbo_cache_current(key, &info)) {
+            status = pbo_cache_restore(pbo, cache->map + key->body, key->body_size, key->size);
+            if(status != EBADMSG) {
+                free(abs);
+                return status;
+            }
+
+            // start over with the archive itself
+            free(pbo->arena);
+            pbo->arena = NULL;
+            pbo->entries = NULL;
+            pbo->entry_count = 0;
+            pbo->properties = NULL;
+            pbo->property_count = 0;
+        }
+    }
+
+    pbo_count(PBO_COUNTER_OPEN, 1);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        status = errno;
+        free(abs);
+        return status;
+    }
+
+    struct stat info;
+    pbo_count(PBO_COUNTER_STAT, 1);
+    status = fstat(fd, &info) != 0 ? errno : pbo_load_mmap(pbo, fd);
+
+    // the mapping outlives the descriptor
+    if(close(fd) != 0 && status == 0) {
+        status = errno;
+    }
+    pbo->map_fd = -1;
+
+    if(status == 0) {
+        status = pbo_cache_add(cache, abs, &info, pbo);
+    }
+
+    free(abs);
+    return status;
+}
+
+static int pbo_cache_record_compare(const void *a, const void *b) {
+    const struct pbo_cache_record *ra = a, *rb = b;
+    int cmp = strcmp(ra->path, rb->path);
+    if(cmp != 0) {
+        return cmp;
+    }
+    // the later of two loads of one path comes first and wins
+    return (ra->seq < rb->seq) - (ra->seq > rb->seq);
+}
+
+static int pbo_cache_write(int fd, const void *buf, size_t len) {
+    for(size_t written = 0; written < len;) {
+        ssize_t wlen = write(fd, (const char *) buf + written, len - written);
+        if(wlen < 0) {
+            return errno;
+        }
+        written += wlen;
+    }
+    return 0;
+}
+
+/*
+ * Merges the records made this run with the cached ones that were not
+ * replaced, dropping those whose archive no longer exists, and writes the
+ * result next to the cache file before renaming it over.
+ */
+static int pbo_cache_save(struct pbo_cache *cache) {
+    int status;
+
+    qsort(cache->records, cache->record_count, sizeof(struct pbo_cache_record), pbo_cache_record_compare);
+
+    size_t total = cache->record_count + cache->count;
+    struct pbo_cache_record *merged = malloc((total > 0 ? total : 1) * sizeof(struct pbo_cache_record));
+    if(merged == NULL) {
+        return errno;
+    }
+
+    size_t count = 0;
+    for(size_t i = 0, j = 0; i < cache->record_count || j < cache->count;) {
+        const char *oldpath = j < cache->count ? cache->map + cache->keys[j].path : NULL;
+        int cmp = i == cache->record_count ? 1 : oldpath == NULL ? -1 : strcmp(cache->records[i].path, oldpath);
+
+        if(cmp <= 0) {
+            merged[count++] = cache->records[i];
+            for(i++; i < cache->record_count && strcmp(cache->records[i].path, merged[count - 1].path) == 0; i++);
+            j += cmp == 0;
+            continue;
+        }
+
+        struct stat info;
+        if(cache->used[j] || stat(oldpath, &info) == 0 || (errno != ENOENT && errno != ENOTDIR)) {
+            merged[count++] = (struct pbo_cache_record) {
+                .path = (char *) oldpath,
+                .key = cache->keys[j],
+                .body = (void *) (cache->map + cache->keys[j].body),
+            };
+        }
+        j++;
+    }
+
+    struct pbo_cache_file head = {
+        .magic = PBO_CACHE_MAGIC,
+        .version = PBO_CACHE_VERSION,
+        .byte_order = PBO_CACHE_BYTE_ORDER,
+        .count = count,
+    };
+
+    size_t offset = sizeof(head) + count * sizeof(struct pbo_cache_key);
+    for(size_t i = 0; i < count; i++) {
+        merged[i].key.path = offset;
+        offset += pbo_cache_align(merged[i].key.pathlen + 1);
+    }
+    for(size_t i = 0; i < count; i++) {
+        merged[i].key.body = offset;
+        offset += merged[i].key.body_size;
+    }
+    head.size = offset;
+
+    size_t pathlen = strlen(cache->path);
+    char *tmppath = malloc(pathlen + sizeof(".XXXXXX"));
+    if(tmppath == NULL) {
+        status = errno;
+        free(merged);
+        return status;
+    }
+    memcpy(tmppath, cache->path, pathlen);
+    memcpy(tmppath + pathlen, ".XXXXXX", sizeof(".XXXXXX"));
+
+    int fd = mkstemp(tmppath);
+    if(fd < 0) {
+        status = errno;
+        free(tmppath);
+        free(merged);
+        return status;
+    }
+
+    status = pbo_cache_write(fd, &head, sizeof(head));
+    for(size_t i = 0; i < count && status == 0; i++) {
+        status = pbo_cache_write(fd, &merged[i].key, sizeof(struct pbo_cache_key));
+    }
+
+    static const char zeros[8];
+    for(size_t i = 0; i < count && status == 0; i++) {
+        size_t len = merged[i].key.pathlen + 1;
+        status = pbo_cache_write(fd, merged[i].path, len);
+        if(status == 0) {
+            status = pbo_cache_write(fd, zeros, pbo_cache_align(len) - len);
+        }
+    }
+    for(size_t i = 0; i < count && status == 0; i++) {
+        status = pbo_cache_write(fd, merged[i].body, merged[i].key.body_size);
+    }
+
+    // replace the old cache only once the new one is complete
+    if(close(fd) != 0 && status == 0) {
+        status = errno;
+    }
+    if(status == 0 && rename(tmppath, cache->path) != 0) {
+        status = errno;
+    }
+    if(status != 0) {
+        unlink(tmppath);
+    }
+
+    free(tmppath);
+    free(merged);
+    return status;
+}
+
+int pbo_cache_close(struct pbo_cache *cache) {
+    int status = 0;
+
+    if(cache->record_count > 0) {
+        status = pbo_cache_save(cache);
+    }
+
+    for(size_t i = 0; i < cache->record_count; i++) {
+        free(cache->records[i].path);
+        free(cache->records[i].body);
+    }
+    free(cache->records);
+
+    if(cache->map != NULL && munmap((void *) cache->map, cache->map_size) != 0 && status == 0) {
+        status = errno;
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->used);
+    free(cache->path);
+    free(cache->cwd);
+    free(cache);
+    return status;
+}
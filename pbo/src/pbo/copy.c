@@ -0,0 +1,232 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/fs.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pbofile.h"
+
+/*
+ * Each backend is tried in turn: a reflink of the block-aligned part of the
+ * range, then an in-kernel copy with copy_file_range() or sendfile(), then a
+ * pread()/pwrite() loop. A backend that reports it is unsupported is skipped
+ * for the rest of the run. Under a paced I/O policy the range is copied one
+ * buffer at a time, so the cap and the cache drops apply in between.
+ */
+static atomic_bool clone_unsupported, copy_file_range_unsupported, sendfile_unsupported;
+
+static bool copy_unsupported(int err) {
+    return err == ENOSYS || err == EOPNOTSUPP || err == ENOTTY || err == EXDEV;
+}
+
+static size_t copy_clone(int in, off_t inoff, int out, off_t outoff, size_t len) {
+    if(atomic_load_explicit(&clone_unsupported, memory_order_relaxed)) {
+        return 0;
+    }
+
+    struct stat info;
+    pbo_count(PBO_COUNTER_STAT, 1);
+    if(fstat(in, &info) != 0 || info.st_blksize <= 0) {
+        return 0;
+    }
+
+    size_t blksize = info.st_blksize;
+    size_t clonelen = len - len % blksize;
+    if(clonelen == 0 || inoff % blksize != 0 || outoff % blksize != 0) {
+        return 0;
+    }
+
+    struct file_clone_range range = {
+        .src_fd = in,
+        .src_offset = inoff,
+        .src_length = clonelen,
+        .dest_offset = outoff,
+    };
+    if(ioctl(out, FICLONERANGE, &range) != 0) {
+        if(copy_unsupported(errno)) {
+            atomic_store_explicit(&clone_unsupported, true, memory_order_relaxed);
+        }
+        return 0;
+    }
+
+    pbo_count(PBO_COUNTER_WRITE, 1);
+    pbo_count(PBO_COUNTER_BYTES_WRITTEN, clonelen);
+    return clonelen;
+}
+
+static int copy_kernel(int in, off_t inoff, int out, off_t outoff, size_t len, size_t *copied) {
+    *copied = 0;
+
+    if(!atomic_load_explicit(&copy_file_range_unsupported, memory_order_relaxed)) {
+        while(*copied < len) {
+            ssize_t status = copy_file_range(in, &inoff, out, &outoff, len - *copied, 0);
+            pbo_count(PBO_COUNTER_WRITE, 1);
+            if(status < 0) {
+                if(*copied == 0 && (copy_unsupported(errno) || errno == EINVAL)) {
+                    atomic_store_explicit(&copy_file_range_unsupported, copy_unsupported(errno), memory_order_relaxed);
+                    break;
+                }
+                return errno;
+            } else if(status == 0) {
+                break;
+            }
+            *copied += status;
+            // the data never passes through user space, so it counts both ways
+            pbo_count(PBO_COUNTER_BYTES_READ, status);
+            pbo_count(PBO_COUNTER_BYTES_WRITTEN, status);
+        }
+
+        if(*copied > 0) {
+            return 0;
+        }
+    }
+
+    if(!atomic_load_explicit(&sendfile_unsupported, memory_order_relaxed)) {
+        pbo_count(PBO_COUNTER_SEEK, 1);
+        if(lseek(out, outoff, SEEK_SET) < 0) {
+            return errno;
+        }
+
+        while(*copied < len) {
+            ssize_t status = sendfile(out, in, &inoff, len - *copied);
+            pbo_count(PBO_COUNTER_WRITE, 1);
+            if(status < 0) {
+                if(*copied == 0 && (copy_unsupported(errno) || errno == EINVAL)) {
+                    atomic_store_explicit(&sendfile_unsupported, copy_unsupported(errno), memory_order_relaxed);
+                    break;
+                }
+                return errno;
+            } else if(status == 0) {
+                break;
+            }
+            *copied += status;
+            // the data never passes through user space, so it counts both ways
+            pbo_count(PBO_COUNTER_BYTES_READ, status);
+            pbo_count(PBO_COUNTER_BYTES_WRITTEN, status);
+        }
+    }
+
+    return 0;
+}
+
+static int copy_buffered(int in, off_t inoff, int out, off_t outoff, size_t len) {
+    size_t buflen = len < pbo_io_buffer_size() ? len : pbo_io_buffer_size();
+    char *iobuf = malloc(buflen);
+    if(iobuf == NULL) {
+        return errno;
+    }
+
+    size_t total = 0;
+    while(total < len) {
+        size_t rlen = len - total < buflen ? len - total : buflen;
+        ssize_t rstatus = pread(in, iobuf, rlen, inoff + total);
+        pbo_count(PBO_COUNTER_READ, 1);
+        if(rstatus < 0) {
+            int status = errno;
+            free(iobuf);
+            return status;
+        } else if(rstatus == 0) {
+            free(iobuf);
+            return EIO;
+        }
+
+        for(ssize_t written = 0; written < rstatus;) {
+            ssize_t wstatus = pwrite(out, iobuf + written, rstatus - written, outoff + total + written);
+            if(wstatus < 0) {
+                int status = errno;
+                free(iobuf);
+                return status;
+            }
+            written += wstatus;
+            pbo_count(PBO_COUNTER_WRITE, 1);
+        }
+
+        total += rstatus;
+        pbo_count(PBO_COUNTER_BYTES_READ, rstatus);
+        pbo_count(PBO_COUNTER_BYTES_WRITTEN, rstatus);
+    }
+
+    free(iobuf);
+    return 0;
+}
+
+static int copy_range(int in, off_t inoff, int out, off_t outoff, size_t len) {
+    int status;
+
+    size_t copied = copy_clone(in, inoff, out, outoff, len);
+    inoff += copied;
+    outoff += copied;
+    len -= copied;
+
+    if(len == 0) {
+        return 0;
+    }
+
+    status = copy_kernel(in, inoff, out, outoff, len, &copied);
+    if(status != 0) {
+        return status;
+    }
+    inoff += copied;
+    outoff += copied;
+    len -= copied;
+
+    if(len == 0) {
+        return 0;
+    }
+
+    return copy_buffered(in, inoff, out, outoff, len);
+}
+
+int pbo_copy_range(int in, off_t inoff, int out, off_t outoff, size_t len) {
+    int status;
+
+    if(!pbo_io_paced()) {
+        return copy_range(in, inoff, out, outoff, len);
+    }
+
+    size_t chunk = pbo_io_buffer_size();
+    pbo_io_willneed(in, inoff, len);
+    for(size_t done = 0; done < len;) {
+        size_t n = len - done < chunk ? len - done : chunk;
+        if(done + n < len) {
+            // the next chunk is read ahead while this one is copied
+            pbo_io_willneed(in, inoff + done + n, len - done - n);
+        }
+        pbo_io_throttle(n);
+
+        status = copy_range(in, inoff + done, out, outoff + done, n);
+        if(status != 0) {
+            return status;
+        }
+
+        pbo_io_dontneed(in, inoff + done, n);
+        pbo_io_dontneed(out, outoff + done, n);
+        done += n;
+    }
+
+    // pages straddling two chunks were only partly done when each was dropped
+    pbo_io_dontneed(in, inoff, len);
+    return 0;
+}
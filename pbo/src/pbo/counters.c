@@ -0,0 +1,51 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdatomic.h>
+
+#include "pbofile.h"
+
+static atomic_bool pbo_counting = false;
+static atomic_ullong pbo_counters[PBO_COUNTER_MAX];
+
+static const char *const pbo_counter_names[PBO_COUNTER_MAX] = {
+    [PBO_COUNTER_OPEN] = "open",
+    [PBO_COUNTER_STAT] = "stat",
+    [PBO_COUNTER_MKDIR] = "mkdir",
+    [PBO_COUNTER_SEEK] = "seek",
+    [PBO_COUNTER_READ] = "read",
+    [PBO_COUNTER_WRITE] = "write",
+    [PBO_COUNTER_BYTES_READ] = "bytes_read",
+    [PBO_COUNTER_BYTES_WRITTEN] = "bytes_written",
+};
+
+void pbo_counters_enable(bool enable) {
+    atomic_store_explicit(&pbo_counting, enable, memory_order_relaxed);
+}
+
+void pbo_count(enum pbo_counter counter, unsigned long long n) {
+    if(atomic_load_explicit(&pbo_counting, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&pbo_counters[counter], n, memory_order_relaxed);
+    }
+}
+
+unsigned long long pbo_counter_get(enum pbo_counter counter) {
+    return atomic_load_explicit(&pbo_counters[counter], memory_order_relaxed);
+}
+
+const char * pbo_counter_name(enum pbo_counter counter) {
+    return pbo_counter_names[counter];
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "pbofile.h"
+
+/*
+ * Paths are compared the way the game resolves them: ASCII case-insensitive,
+ * with '/' and '\' being the same separator.
+ */
+
+static inline unsigned char pbo_path_fold(unsigned char c) {
+    if(c >= 'A' && c <= 'Z') {
+        return c - 'A' + 'a';
+    }
+    if(c == '/') {
+        return '\\';
+    }
+    return c;
+}
+
+static uint32_t pbo_path_hash(const char *path) {
+    uint32_t hash = 2166136261u;
+    for(const unsigned char *c = (const unsigned char *) path; *c != '\0'; c++) {
+        hash = (hash ^ pbo_path_fold(*c)) * 16777619u;
+    }
+    return hash;
+}
+
+static bool pbo_path_equal(const char *a, const char *b) {
+    const unsigned char *ca = (const unsigned char *) a, *cb = (const unsigned char *) b;
+    for(; *ca != '\0' && *cb != '\0'; ca++, cb++) {
+        if(pbo_path_fold(*ca) != pbo_path_fold(*cb)) {
+            return false;
+        }
+    }
+    return *ca == *cb;
+}
+
+static int pbo_index_build(struct pbo *pbo) {
+    if(pbo->entry_count > UINT32_MAX / 2) {
+        return EOVERFLOW;
+    }
+
+    size_t size = 16;
+    while(size < pbo->entry_count * 2) {
+        size *= 2;
+    }
+
+    struct pbo_index *index = calloc(1, sizeof(struct pbo_index) + size * sizeof(struct pbo_index_slot));
+    if(index == NULL) {
+        return errno;
+    }
+    index->mask = size - 1;
+
+    struct pbo_index_slot *slots = index->slots;
+    for(size_t i = 0; i < pbo->entry_count; i++) {
+        uint32_t hash = pbo_path_hash(pbo->entries[i].path);
+        for(size_t s = hash & (size - 1);; s = (s + 1) & (size - 1)) {
+            if(slots[s].entry == 0) {
+                slots[s].hash = hash;
+                slots[s].entry = i + 1;
+                break;
+            }
+
+            // the first entry of a path wins
+            if(slots[s].hash == hash && pbo_path_equal(pbo->entries[slots[s].entry - 1].path, pbo->entries[i].path)) {
+                break;
+            }
+        }
+    }
+
+    struct pbo_index *expected = NULL;
+    if(!atomic_compare_exchange_strong_explicit(&pbo->index, &expected, index, memory_order_acq_rel, memory_order_acquire)) {
+        free(index); // another thread got there first with the same index
+    }
+    return 0;
+}
+
+struct pbo_entry * pbo_find_entry(struct pbo *pbo, const char *path) {
+    struct pbo_index *index = atomic_load_explicit(&pbo->index, memory_order_acquire);
+    if(index == NULL) {
+        int status = pbo_index_build(pbo);
+        if(status != 0) {
+            errno = status;
+            return NULL;
+        }
+        index = atomic_load_explicit(&pbo->index, memory_order_acquire);
+    }
+
+    uint32_t hash = pbo_path_hash(path);
+    for(size_t s = hash & index->mask; index->slots[s].entry != 0; s = (s + 1) & index->mask) {
+        struct pbo_entry *ent = &pbo->entries[index->slots[s].entry - 1];
+        if(index->slots[s].hash == hash && pbo_path_equal(ent->path, path)) {
+            return ent;
+        }
+    }
+
+    errno = ENOENT;
+    return NULL;
+}
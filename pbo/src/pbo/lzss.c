@@ -0,0 +1,380 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pbofile.h"
+
+/*
+ * Compressed entries use the LZSS variant found in OFP/Arma PBOs. Each
+ * group starts with a flag byte read from the least significant bit up: a
+ * set bit is a literal byte, a clear bit a two byte back-reference of 12
+ * bits of distance and 4 bits of length (3 to 18 bytes). References before
+ * the start of the data read spaces. The data is followed by a 32-bit sum
+ * of all decompressed bytes.
+ */
+
+#define LZSS_GROUP_INPUT_MAX (1 + 8 * 2)
+#define LZSS_GROUP_OUTPUT_MAX (8 * 18)
+
+static int lzss_fill(struct pbo_lzss *lz, size_t need) {
+    if(lz->inlen - lz->inpos >= need || lz->eof) {
+        return 0;
+    }
+
+    memmove(lz->in, lz->in + lz->inpos, lz->inlen - lz->inpos);
+    lz->inlen -= lz->inpos;
+    lz->inpos = 0;
+
+    while(lz->inlen < need) {
+        ssize_t rlen = lz->read(lz->ctx, lz->in + lz->inlen, sizeof(lz->in) - lz->inlen);
+        if(rlen < 0) {
+            return errno;
+        } else if(rlen == 0) {
+            lz->eof = true;
+            break;
+        }
+        lz->inlen += rlen;
+    }
+
+    return 0;
+}
+
+static inline void lzss_copy_match(unsigned char *dst, size_t dist, size_t len) {
+    const unsigned char *src = dst - dist;
+    if(dist >= 16) {
+        // the second copy may overlap the first, which is what LZ semantics
+        // ask for; anything past len is overwritten by later output
+        memcpy(dst, src, 16);
+        memcpy(dst + 16, src + 16, 2);
+    } else {
+        for(size_t i = 0; i < len; i++) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static int lzss_decode_group_fast(struct pbo_lzss *lz) {
+    const unsigned char *in = lz->in + lz->inpos;
+    unsigned char *out = lz->out + lz->head;
+
+    unsigned flags = *in++;
+    if(flags == 0xFF) {
+        memcpy(out, in, 8);
+        in += 8;
+        out += 8;
+    } else {
+        for(int bit = 0; bit < 8; bit++, flags >>= 1) {
+            if(flags & 1) {
+                *out++ = *in++;
+                continue;
+            }
+
+            size_t dist = in[0] | ((in[1] & 0xF0) << 4);
+            size_t len = (in[1] & 0x0F) + 3;
+            in += 2;
+
+            if(dist == 0) {
+                return EBADMSG;
+            }
+
+            lzss_copy_match(out, dist, len);
+            out += len;
+        }
+    }
+
+    size_t produced = out - (lz->out + lz->head);
+    lz->inpos = in - lz->in;
+    lz->head += produced;
+    lz->remaining -= produced;
+    return 0;
+}
+
+static int lzss_decode_group_slow(struct pbo_lzss *lz) {
+    if(lz->inlen - lz->inpos < 1) {
+        return EIO;
+    }
+
+    unsigned flags = lz->in[lz->inpos++];
+    for(int bit = 0; bit < 8 && lz->remaining > 0; bit++, flags >>= 1) {
+        if(flags & 1) {
+            if(lz->inlen - lz->inpos < 1) {
+                return EIO;
+            }
+
+            lz->out[lz->head++] = lz->in[lz->inpos++];
+            lz->remaining--;
+            continue;
+        }
+
+        if(lz->inlen - lz->inpos < 2) {
+            return EIO;
+        }
+
+        const unsigned char *in = lz->in + lz->inpos;
+        size_t dist = in[0] | ((in[1] & 0xF0) << 4);
+        size_t len = (in[1] & 0x0F) + 3;
+        lz->inpos += 2;
+
+        if(dist == 0 || len > lz->remaining) {
+            return EBADMSG;
+        }
+
+        unsigned char *out = lz->out + lz->head;
+        for(size_t i = 0; i < len; i++) {
+            out[i] = out[i - dist];
+        }
+        lz->head += len;
+        lz->remaining -= len;
+    }
+
+    return 0;
+}
+
+static int lzss_decode(struct pbo_lzss *lz) {
+    int status;
+
+    // keep only the window of history once everything decoded has been read
+    if(lz->head > PBO_LZSS_WINDOW) {
+        memmove(lz->out, lz->out + lz->head - PBO_LZSS_WINDOW, PBO_LZSS_WINDOW);
+        lz->head = lz->tail = PBO_LZSS_WINDOW;
+    }
+
+    while(lz->remaining > 0 && lz->head < PBO_LZSS_WINDOW + PBO_LZSS_CHUNK) {
+        status = lzss_fill(lz, LZSS_GROUP_INPUT_MAX);
+        if(status != 0) {
+            return status;
+        }
+
+        if(lz->inlen - lz->inpos >= LZSS_GROUP_INPUT_MAX && lz->remaining >= LZSS_GROUP_OUTPUT_MAX) {
+            status = lzss_decode_group_fast(lz);
+        } else {
+            status = lzss_decode_group_slow(lz);
+        }
+        if(status != 0) {
+            return status;
+        }
+    }
+
+    uint32_t sum = 0, high = 0;
+    for(const unsigned char *c = lz->out + lz->tail; c < lz->out + lz->head; c++) {
+        sum += *c;
+        high += *c >> 7;
+    }
+    lz->checksum += sum;
+    lz->checksum_high += high;
+
+    if(lz->remaining == 0) {
+        status = lzss_fill(lz, sizeof(uint32_t));
+        if(status != 0) {
+            return status;
+        }
+
+        if(lz->inlen - lz->inpos < sizeof(uint32_t)) {
+            return EIO;
+        }
+
+        uint32_t checksum;
+        memcpy(&checksum, lz->in + lz->inpos, sizeof(checksum));
+        checksum = le32toh(checksum);
+        lz->inpos += sizeof(uint32_t);
+
+        // encoders disagree on whether bytes are summed signed or unsigned
+        if(checksum != lz->checksum && checksum != lz->checksum - 256 * lz->checksum_high) {
+            return EBADMSG;
+        }
+        lz->finished = true;
+    }
+
+    return 0;
+}
+
+int pbo_lzss_init(struct pbo_lzss **lz_ptr, size_t size, ssize_t (*read)(void *ctx, void *buf, size_t len), void *ctx) {
+    struct pbo_lzss *lz = malloc(sizeof(struct pbo_lzss));
+    if(lz == NULL) {
+        return errno;
+    }
+
+    lz->read = read;
+    lz->ctx = ctx;
+    lz->remaining = size;
+    lz->checksum = 0;
+    lz->checksum_high = 0;
+    lz->inpos = lz->inlen = 0;
+    lz->eof = false;
+    lz->finished = false;
+
+    memset(lz->out, ' ', PBO_LZSS_WINDOW);
+    lz->head = lz->tail = PBO_LZSS_WINDOW;
+
+    *lz_ptr = lz;
+    return 0;
+}
+
+int pbo_lzss_read(struct pbo_lzss *lz, void *buf, size_t len, size_t *rlen) {
+    int status;
+
+    if(lz->tail == lz->head && !lz->finished) {
+        status = lzss_decode(lz);
+        if(status != 0) {
+            return status;
+        }
+    }
+
+    size_t avail = lz->head - lz->tail;
+    if(len > avail) {
+        len = avail;
+    }
+
+    memcpy(buf, lz->out + lz->tail, len);
+    lz->tail += len;
+    *rlen = len;
+    return 0;
+}
+
+void pbo_lzss_free(struct pbo_lzss *lz) {
+    free(lz);
+}
+
+#define LZSS_HASH_BITS 14
+#define LZSS_MATCH_MIN 3
+#define LZSS_MATCH_MAX 18
+#define LZSS_DIST_MAX (PBO_LZSS_WINDOW - 1)
+
+static inline uint32_t lzss_hash(const unsigned char *in) {
+    uint32_t key = in[0] | (in[1] << 8) | (in[2] << 16);
+    return (key * 2654435761u) >> (32 - LZSS_HASH_BITS);
+}
+
+static inline void lzss_insert(int32_t *head, int32_t *prev, const unsigned char *in, size_t pos, size_t len) {
+    if(pos + LZSS_MATCH_MIN <= len) {
+        uint32_t hash = lzss_hash(in + pos);
+        prev[pos & LZSS_DIST_MAX] = head[hash];
+        head[hash] = pos;
+    }
+}
+
+/*
+ * Greedy compressor over hash chains of three byte prefixes. The level sets
+ * how many chain links are followed per position, trading speed for ratio.
+ * Returns ENOSPC as soon as the output grows past `limit` bytes.
+ */
+int pbo_lzss_compress(const void *src, size_t len, int level, size_t limit, void **dst, size_t *dstlen) {
+    const unsigned char *in = src;
+
+    if(len > INT32_MAX) {
+        return EOVERFLOW;
+    }
+
+    size_t bound = len + (len + 7) / 8 + sizeof(uint32_t);
+    unsigned char *out = malloc(bound);
+    int32_t *head = malloc(sizeof(int32_t) << LZSS_HASH_BITS);
+    int32_t *prev = malloc(sizeof(int32_t) * PBO_LZSS_WINDOW);
+    if(out == NULL || head == NULL || prev == NULL) {
+        int status = errno;
+        free(out);
+        free(head);
+        free(prev);
+        return status;
+    }
+    memset(head, 0xFF, sizeof(int32_t) << LZSS_HASH_BITS);
+
+    unsigned maxchain = 1u << (level < 1 ? 1 : level > 12 ? 12 : level);
+
+    size_t pos = 0, outpos = 0;
+    while(pos < len) {
+        size_t flagpos = outpos++;
+        unsigned flags = 0;
+
+        for(int bit = 0; bit < 8 && pos < len; bit++) {
+            size_t maxlen = len - pos < LZSS_MATCH_MAX ? len - pos : LZSS_MATCH_MAX;
+            size_t bestlen = 0, bestdist = 0;
+
+            if(maxlen >= LZSS_MATCH_MIN) {
+                unsigned chain = maxchain;
+                for(int32_t cand = head[lzss_hash(in + pos)]; cand >= 0 && chain > 0; cand = prev[cand & LZSS_DIST_MAX], chain--) {
+                    size_t dist = pos - cand;
+                    if(dist > LZSS_DIST_MAX) {
+                        break;
+                    }
+
+                    if(in[cand + bestlen] != in[pos + bestlen]) {
+                        continue;
+                    }
+
+                    size_t matchlen = 0;
+                    while(matchlen < maxlen && in[cand + matchlen] == in[pos + matchlen]) {
+                        matchlen++;
+                    }
+
+                    if(matchlen > bestlen) {
+                        bestlen = matchlen;
+                        bestdist = dist;
+                        if(matchlen == maxlen) {
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if(bestlen >= LZSS_MATCH_MIN) {
+                out[outpos++] = bestdist & 0xFF;
+                out[outpos++] = ((bestdist >> 4) & 0xF0) | (bestlen - LZSS_MATCH_MIN);
+
+                for(size_t i = 0; i < bestlen; i++) {
+                    lzss_insert(head, prev, in, pos + i, len);
+                }
+                pos += bestlen;
+            } else {
+                flags |= 1u << bit;
+                out[outpos++] = in[pos];
+
+                lzss_insert(head, prev, in, pos, len);
+                pos++;
+            }
+        }
+
+        out[flagpos] = flags;
+        if(outpos > limit) {
+            break;
+        }
+    }
+
+    free(head);
+    free(prev);
+
+    if(outpos + sizeof(uint32_t) > limit) {
+        free(out);
+        return ENOSPC;
+    }
+
+    uint32_t checksum = 0;
+    for(size_t i = 0; i < len; i++) {
+        checksum += in[i];
+    }
+    checksum = htole32(checksum);
+    memcpy(out + outpos, &checksum, sizeof(checksum));
+    outpos += sizeof(checksum);
+
+    unsigned char *shrunk = realloc(out, outpos);
+    *dst = shrunk != NULL ? shrunk : out;
+    *dstlen = outpos;
+    return 0;
+}
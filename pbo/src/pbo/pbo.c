@@ -15,99 +15,178 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "pbofile.h"
 
-int pbo_entry_init(struct pbo_entry **ent_ptr) {
-    struct pbo_entry *ent = calloc(1, sizeof(struct pbo_entry));
-    if(ent == NULL) {
+int pbo_init(struct pbo **pbo_ptr) {
+    struct pbo *pbo = calloc(1, sizeof(struct pbo));
+    if(pbo == NULL) {
         return errno;
     }
 
-    *ent_ptr = ent;
-    return 0;
-}
-
-int pbo_entry_free(struct pbo_entry *ent) {
-    free(ent->path);
-    free(ent);
+    *pbo_ptr = pbo;
     return 0;
 }
 
-int pbo_property_init(struct pbo_property **prop_ptr) {
-    struct pbo_property *prop = calloc(1, sizeof(struct pbo_property));
-    if(prop == NULL) {
+int pbo_destroy(struct pbo *pbo) {
+    if(pbo->map != NULL && munmap(pbo->map, pbo->map_size) != 0) {
         return errno;
     }
 
-    *prop_ptr = prop;
-    return 0;
-}
+    for(struct pbo_block *block = pbo->blocks; block != NULL;) {
+        struct pbo_block *next = block->next;
+        free(block);
+        block = next;
+    }
 
-int pbo_property_free(struct pbo_property *prop) {
-    free(prop->key);
-    free(prop->value);
-    free(prop);
+    if(pbo->entry_capacity > 0) {
+        for(struct pbo_entry *ent = pbo->entries; ent < pbo->entries + pbo->entry_count; ent++) {
+            free(ent->packed);
+        }
+        free(pbo->entries);
+    }
+    if(pbo->property_capacity > 0) {
+        free(pbo->properties);
+    }
+
+    free(pbo->index);
+    free(pbo->arena);
+    free(pbo);
     return 0;
 }
 
-int pbo_init(struct pbo **pbo_ptr) {
-    struct pbo *pbo = calloc(1, sizeof(struct pbo));
-    if(pbo == NULL) {
-        return errno;
+#define PBO_BLOCK_SIZE 65536
+
+static const char * pbo_strdup(struct pbo *pbo, const char *str) {
+    size_t len = strlen(str) + 1;
+
+    struct pbo_block *block = pbo->blocks;
+    if(block == NULL || block->size - block->used < len) {
+        size_t size = len > PBO_BLOCK_SIZE ? len : PBO_BLOCK_SIZE;
+        block = malloc(sizeof(struct pbo_block) + size);
+        if(block == NULL) {
+            return NULL;
+        }
+
+        block->next = pbo->blocks;
+        block->size = size;
+        block->used = 0;
+        pbo->blocks = block;
     }
 
-    *pbo_ptr = pbo;
-    return 0;
+    char *copy = block->data + block->used;
+    memcpy(copy, str, len);
+    block->used += len;
+    return copy;
 }
 
-static int pbo_entries_free(struct pbo *pbo) {
-    int status;
+static int pbo_table_grow(void **table, size_t count, size_t *capacity, size_t size) {
+    // keep room for the terminating slot
+    if(*capacity > count + 1) {
+        return 0;
+    }
+
+    size_t newcap = *capacity > 0 ? *capacity * 2 : 64;
+    while(newcap <= count + 1) {
+        newcap *= 2;
+    }
 
-    for(struct pbo_entry *ent = pbo->entries; ent != NULL;) {
-        struct pbo_entry *next = ent->next;
-        status = pbo_entry_free(ent);
-        if(status != 0) {
-            return status;
+    void *newtable;
+    if(*capacity > 0) {
+        newtable = realloc(*table, newcap * size);
+    } else {
+        // the table still lives in the arena, if anywhere
+        newtable = malloc(newcap * size);
+        if(newtable != NULL && count > 0) {
+            memcpy(newtable, *table, count * size);
         }
-        ent = next;
+    }
+    if(newtable == NULL) {
+        return errno;
     }
 
-    pbo->entries = NULL;
+    *table = newtable;
+    *capacity = newcap;
     return 0;
 }
 
-static int pbo_properties_free(struct pbo *pbo) {
+int pbo_add_property(struct pbo *pbo, const char *key, const char *value) {
     int status;
 
-    for(struct pbo_property *prop = pbo->properties; prop != NULL;) {
-        struct pbo_property *next = prop->next;
-        status = pbo_property_free(prop);
-        if(status != 0) {
-            return status;
-        }
-        prop = next;
+    if(*key == '\0' || strlen(key) >= 32 || strlen(value) >= 256) {
+        return EINVAL;
+    }
+
+    status = pbo_table_grow((void **) &pbo->properties, pbo->property_count, &pbo->property_capacity, sizeof(struct pbo_property));
+    if(status != 0) {
+        return status;
     }
 
-    pbo->properties = NULL;
+    struct pbo_property prop = {
+        .key = pbo_strdup(pbo, key),
+        .value = pbo_strdup(pbo, value),
+    };
+    if(prop.key == NULL || prop.value == NULL) {
+        return errno;
+    }
+
+    pbo->properties[pbo->property_count++] = prop;
+    pbo->properties[pbo->property_count] = (struct pbo_property) { 0 };
     return 0;
 }
 
-int pbo_destroy(struct pbo *pbo) {
+int pbo_add_entry(struct pbo *pbo, const char *path, const char *source, const struct stat *info) {
     int status;
 
-    status = pbo_entries_free(pbo);
-    if(status != 0) {
-        return status;
+    if(*path == '\0') {
+        return EINVAL;
+    } else if(strlen(path) >= PATH_MAX) {
+        return ENAMETOOLONG;
+    }
+
+    struct stat srcinfo;
+    if(info == NULL) {
+        pbo_count(PBO_COUNTER_STAT, 1);
+        if(stat(source, &srcinfo) != 0) {
+            return errno;
+        }
+        info = &srcinfo;
+    }
+
+    if(!S_ISREG(info->st_mode)) {
+        return EINVAL;
+    } else if(info->st_size > UINT32_MAX || info->st_mtime < 0 || info->st_mtime > UINT32_MAX) {
+        return EOVERFLOW;
     }
 
-    status = pbo_properties_free(pbo);
+    status = pbo_table_grow((void **) &pbo->entries, pbo->entry_count, &pbo->entry_capacity, sizeof(struct pbo_entry));
     if(status != 0) {
         return status;
     }
 
-    free(pbo);
+    struct pbo_entry ent = {
+        .path = pbo_strdup(pbo, path),
+        .source = pbo_strdup(pbo, source),
+        .type = PBO_ENTRY_NULL,
+        .original_size = info->st_size,
+        .timestamp = info->st_mtime,
+        .data_size = info->st_size,
+    };
+    if(ent.path == NULL || ent.source == NULL) {
+        return errno;
+    }
+
+    pbo->entries[pbo->entry_count++] = ent;
+    pbo->entries[pbo->entry_count] = (struct pbo_entry) { 0 };
+
+    // the index no longer covers every entry
+    free(pbo->index);
+    pbo->index = NULL;
     return 0;
 }
 
@@ -124,7 +203,8 @@ const char * pbo_property_value(struct pbo_property *prop) {
 }
 
 struct pbo_property * pbo_property_next(struct pbo_property *prop) {
-    return prop->next;
+    prop++;
+    return prop->key != NULL ? prop : NULL;
 }
 
 const char * pbo_entry_path(struct pbo_entry *ent) {
@@ -132,13 +212,79 @@ const char * pbo_entry_path(struct pbo_entry *ent) {
 }
 
 struct pbo_entry * pbo_entry_next(struct pbo_entry *ent) {
-    return ent->next;
+    ent++;
+    return ent->path != NULL ? ent : NULL;
+}
+
+off_t pbo_entry_data_size(struct pbo_entry *ent) {
+    return ent->data_size;
+}
+
+off_t pbo_entry_offset(struct pbo_entry *ent) {
+    return ent->offset;
+}
+
+int pbo_entry_reuse(struct pbo_entry *ent, struct pbo_entry *from) {
+    if(from->origin == NULL) {
+        return ENODATA;
+    } else if(ent->packed != NULL || ent->origin != NULL) {
+        return EINVAL;
+    }
+
+    ent->data = from->data;
+    ent->origin = from->origin;
+    ent->type = from->type;
+    ent->original_size = from->original_size;
+    ent->data_size = from->data_size;
+    return 0;
+}
+
+bool pbo_entry_is_compressed(struct pbo_entry *ent) {
+    return ent->type == PBO_ENTRY_CPRS;
+}
+
+off_t pbo_entry_original_size(struct pbo_entry *ent) {
+    return ent->original_size;
+}
+
+time_t pbo_entry_timestamp(struct pbo_entry *ent) {
+    return ent->timestamp;
+}
+
+int pbo_entry_data(struct pbo_entry *ent, const void **data, size_t *len) {
+    if(ent->data == NULL) {
+        return ENODATA;
+    }
+
+    *data = ent->data;
+    *len = ent->data_size;
+    return 0;
 }
 
 struct pbo_entry * pbo_get_entries(struct pbo *pbo) {
-    return pbo->entries;
+    return pbo->entry_count > 0 ? pbo->entries : NULL;
 }
 
 struct pbo_property * pbo_get_properties(struct pbo *pbo) {
-    return pbo->properties;
+    return pbo->property_count > 0 ? pbo->properties : NULL;
+}
+
+size_t pbo_get_entry_count(struct pbo *pbo) {
+    return pbo->entry_count;
+}
+
+struct pbo_entry * pbo_get_entry(struct pbo *pbo, size_t index) {
+    return index < pbo->entry_count ? &pbo->entries[index] : NULL;
+}
+
+size_t pbo_get_property_count(struct pbo *pbo) {
+    return pbo->property_count;
+}
+
+struct pbo_property * pbo_get_property(struct pbo *pbo, size_t index) {
+    return index < pbo->property_count ? &pbo->properties[index] : NULL;
+}
+
+off_t pbo_get_data_offset(struct pbo *pbo) {
+    return pbo->data_offset;
 }
@@ -16,6 +16,11 @@
 
 #pragma once
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <unistd.h>
 #include <time.h>
 
 #include "../pbo.h"
@@ -23,34 +28,163 @@
 enum pbo_entry_type {
     PBO_ENTRY_NULL,
     PBO_ENTRY_VERS,
+    PBO_ENTRY_CPRS,
 };
 
 struct pbo_entry {
-    char *path;
+    const char *path;
+    const void *data;
+    const char *source; // file to read the data from when saving
+    void *packed; // compressed data owned by the entry
+    const struct pbo *origin; // mapped PBO that data points into
 
     enum pbo_entry_type type;
 
-    long original_size;
-    long offset;
+    // checked against the size of a loaded PBO, so offset + data_size fits off_t
+    uint64_t original_size;
+    uint64_t offset;
     time_t timestamp;
-    long data_size;
-
-    struct pbo_entry *next;
+    uint64_t data_size;
 };
 
 struct pbo_property {
-    char *key, *value;
+    const char *key, *value;
+};
+
+struct pbo_block {
+    struct pbo_block *next;
+    size_t size, used;
+    char data[];
+};
+
+struct pbo_index_slot {
+    uint32_t hash;
+    uint32_t entry; // index + 1, 0 if free
+};
 
-    struct pbo_property *next;
+struct pbo_index {
+    size_t mask;
+    struct pbo_index_slot slots[];
 };
 
+/*
+ * Entry and property tables are contiguous arrays, each followed by a zeroed
+ * terminating slot. Tables and strings of a loaded PBO live in a single arena
+ * allocation; strings of a mapped PBO are views into the mapping instead.
+ * Adding to a PBO moves the affected table to its own growable allocation
+ * and packs new strings into blocks.
+ */
 struct pbo {
+    void *arena;
+    struct pbo_block *blocks;
+
     struct pbo_entry *entries;
+    size_t entry_count, entry_capacity;
     struct pbo_property *properties;
+    size_t property_count, property_capacity;
+
+    void *map;
+    size_t map_size;
+    int map_fd; // not owned
+
+    uint64_t data_offset; // end of the header of a loaded PBO
+
+    // built on the first lookup; racing builders publish one with a CAS
+    struct pbo_index *_Atomic index;
+};
+
+/*
+ * The policy set with pbo_io_policy(), applied by extraction and copies.
+ * While paced, transfers go in chunks of the buffer size, each throttled to
+ * the bandwidth cap and dropped from the page cache once done. Hints and
+ * drops are no-ops unless the cache is to be spared; a `len` of 0 means up
+ * to the end of the file.
+ */
+bool pbo_io_paced(void);
+size_t pbo_io_buffer_size(void);
+void pbo_io_throttle(size_t len); // sleeps until `len` more bytes may be written
+void pbo_io_willneed(int fd, off_t offset, size_t len);
+void pbo_io_dontneed(int fd, off_t offset, size_t len);
+void pbo_io_written(int fd); // starts writeback of a finished output and drops it in a later batch
+
+/*
+ * Copies len bytes between positioned ranges of two descriptors without
+ * moving the input's file offset.
+ */
+int pbo_copy_range(int in, off_t inoff, int out, off_t outoff, size_t len);
+
+/*
+ * One file transferred through io_uring: opened with openat(), read into or
+ * written from `buf` at offset 0 as the open flags say, and closed again.
+ * With `srcfd` set, the buffer is first filled from there. `status` is the
+ * first error of the chain, EIO for a short transfer.
+ */
+struct pbo_uring_op {
+    int dirfd;
+    const char *path;
+    int flags;
+
+    void *buf;
+    size_t len;
+    int srcfd; // -1 if unused
+    off_t srcoff;
+
+    int status;
+    unsigned slot;
+};
+
+struct pbo_uring;
+
+// ENOSYS unless pbo_io_uring() enabled it and the kernel supports it
+int pbo_uring_init(struct pbo_uring **ring);
+/*
+ * Runs the operations and sets the status of each. If the ring fails, the
+ * error is returned once every chain the kernel took has completed, and the
+ * operations it never ran are left with ECANCELED.
+ */
+int pbo_uring_run(struct pbo_uring *ring, struct pbo_uring_op *ops, size_t count);
+void pbo_uring_destroy(struct pbo_uring *ring);
+
+#define PBO_LZSS_WINDOW 4096
+#define PBO_LZSS_CHUNK 65536
+
+/*
+ * Streaming decoder for compressed entries. Memory use is bounded by the
+ * buffers below regardless of the entry size; the checksum is verified once
+ * the last byte has been decoded.
+ */
+struct pbo_lzss {
+    ssize_t (*read)(void *ctx, void *buf, size_t len);
+    void *ctx;
+
+    size_t remaining;
+    uint32_t checksum, checksum_high;
+
+    unsigned char in[PBO_LZSS_CHUNK];
+    size_t inpos, inlen;
+    bool eof, finished;
+
+    unsigned char out[PBO_LZSS_WINDOW + PBO_LZSS_CHUNK + 8 * 18 + 16];
+    size_t head, tail;
 };
 
-int pbo_entry_init(struct pbo_entry **ent);
-int pbo_entry_free(struct pbo_entry *ent);
+int pbo_lzss_init(struct pbo_lzss **lz, size_t size, ssize_t (*read)(void *ctx, void *buf, size_t len), void *ctx);
+int pbo_lzss_read(struct pbo_lzss *lz, void *buf, size_t len, size_t *rlen);
+void pbo_lzss_free(struct pbo_lzss *lz);
+
+int pbo_lzss_compress(const void *src, size_t len, int level, size_t limit, void **dst, size_t *dstlen);
+
+#define PBO_SHA1_SIZE 20
+
+struct pbo_sha1 {
+    void (*blocks)(uint32_t state[5], const unsigned char *data, size_t blocks); // picked for the running CPU
+    uint32_t state[5];
+    uint64_t len;
+    unsigned char buf[64];
+    size_t buflen;
+};
 
-int pbo_property_init(struct pbo_property **prop);
-int pbo_property_free(struct pbo_property *prop);
+void pbo_sha1_init(struct pbo_sha1 *sha);
+void pbo_sha1_update(struct pbo_sha1 *sha, const void *data, size_t len);
+void pbo_sha1_final(struct pbo_sha1 *sha, unsigned char digest[PBO_SHA1_SIZE]);
+const char * pbo_sha1_impl(void);
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pbofile.h"
+
+#define PBO_IO_BUFFER_DEFAULT (1 << 20)
+#define PBO_IO_BUFFER_ALIGN (64 << 10)
+#define PBO_IO_BUFFER_MAX (1 << 30)
+#define PBO_IO_DROP_BATCH 64
+
+static atomic_bool pbo_io_drop = false;
+static atomic_size_t pbo_io_buffer = PBO_IO_BUFFER_DEFAULT;
+static atomic_ullong pbo_io_rate = 0;
+
+// when the bytes let through so far will all have been written at the cap
+static pthread_mutex_t pbo_io_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t pbo_io_next;
+
+// copies of written files whose pages are dropped once a batch is full
+static pthread_mutex_t pbo_io_pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static int pbo_io_pending[PBO_IO_DROP_BATCH];
+static size_t pbo_io_pending_count;
+
+static void pbo_io_drop_files(const int *fds, size_t count) {
+    for(size_t i = 0; i < count; i++) {
+        sync_file_range(fds[i], 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fds[i], 0, 0, POSIX_FADV_DONTNEED);
+        close(fds[i]);
+    }
+}
+
+static void pbo_io_flush(void) {
+    int fds[PBO_IO_DROP_BATCH];
+
+    pthread_mutex_lock(&pbo_io_pending_lock);
+    size_t count = pbo_io_pending_count;
+    memcpy(fds, pbo_io_pending, count * sizeof(int));
+    pbo_io_pending_count = 0;
+    pthread_mutex_unlock(&pbo_io_pending_lock);
+
+    pbo_io_drop_files(fds, count);
+}
+
+int pbo_io_policy(const struct pbo_io_policy *policy) {
+    size_t buffer = policy->buffer_size != 0 ? policy->buffer_size : PBO_IO_BUFFER_DEFAULT;
+    if(buffer < PBO_IO_BUFFER_ALIGN || buffer > PBO_IO_BUFFER_MAX) {
+        return EINVAL;
+    }
+
+    atomic_store_explicit(&pbo_io_drop, policy->drop_cache, memory_order_relaxed);
+    atomic_store_explicit(&pbo_io_buffer, buffer - buffer % PBO_IO_BUFFER_ALIGN, memory_order_relaxed);
+    atomic_store_explicit(&pbo_io_rate, policy->bandwidth, memory_order_relaxed);
+    if(!policy->drop_cache) {
+        pbo_io_flush();
+    }
+    return 0;
+}
+
+bool pbo_io_paced(void) {
+    return atomic_load_explicit(&pbo_io_drop, memory_order_relaxed) || atomic_load_explicit(&pbo_io_rate, memory_order_relaxed) != 0;
+}
+
+size_t pbo_io_buffer_size(void) {
+    return atomic_load_explicit(&pbo_io_buffer, memory_order_relaxed);
+}
+
+static uint64_t pbo_io_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void pbo_io_throttle(size_t len) {
+    unsigned long long rate = atomic_load_explicit(&pbo_io_rate, memory_order_relaxed);
+    if(rate == 0 || len == 0) {
+        return;
+    }
+
+    uint64_t now = pbo_io_now();
+
+    // each caller gets the next slot of the shared budget; idle time is not saved up
+    pthread_mutex_lock(&pbo_io_lock);
+    uint64_t start = pbo_io_next > now ? pbo_io_next : now;
+    pbo_io_next = start + (uint64_t) (len * 1e9 / rate);
+    pthread_mutex_unlock(&pbo_io_lock);
+
+    if(start > now) {
+        struct timespec until = {
+            .tv_sec = start / 1000000000,
+            .tv_nsec = start % 1000000000,
+        };
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+    }
+}
+
+void pbo_io_willneed(int fd, off_t offset, size_t len) {
+    if(!atomic_load_explicit(&pbo_io_drop, memory_order_relaxed)) {
+        return;
+    }
+
+    // reading ahead of more than one buffer would only crowd the cache again
+    size_t buffer = pbo_io_buffer_size();
+    posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, offset, len < buffer ? len : buffer, POSIX_FADV_WILLNEED);
+}
+
+void pbo_io_dontneed(int fd, off_t offset, size_t len) {
+    if(atomic_load_explicit(&pbo_io_drop, memory_order_relaxed)) {
+        posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+    }
+}
+
+void pbo_io_written(int fd) {
+    if(!atomic_load_explicit(&pbo_io_drop, memory_order_relaxed)) {
+        return;
+    }
+
+    // dirty pages are not dropped, so their writeback starts now and is waited for a batch later
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    int copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if(copy < 0) {
+        return;
+    }
+
+    int fds[PBO_IO_DROP_BATCH];
+    size_t count = 0;
+
+    pthread_mutex_lock(&pbo_io_pending_lock);
+    pbo_io_pending[pbo_io_pending_count++] = copy;
+    if(pbo_io_pending_count == PBO_IO_DROP_BATCH) {
+        count = pbo_io_pending_count;
+        memcpy(fds, pbo_io_pending, count * sizeof(int));
+        pbo_io_pending_count = 0;
+    }
+    pthread_mutex_unlock(&pbo_io_pending_lock);
+
+    pbo_io_drop_files(fds, count);
+}
+
+void pbo_io_release(int fd) {
+    if(!atomic_load_explicit(&pbo_io_drop, memory_order_relaxed)) {
+        return;
+    }
+
+    pbo_io_flush();
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
@@ -16,313 +16,1200 @@
 
 #include <endian.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "pbofile.h"
 
-static int fgetasciiz(FILE *file, char *buf, size_t len) {
-    for(size_t i = 0; i < len; i++) {
-        int c = fgetc(file);
-        if(c == EOF) {
+/*
+ * Header parsing runs over an in-memory cursor. When the cursor is backed by
+ * a FILE, the bytes of each field are appended to the cursor buffer as they
+ * are consumed, so that reading a header from a stream leaves an exact copy
+ * of it in memory and nothing past it is read.
+ */
+struct pbo_cursor {
+    const char *buf;
+    size_t pos, len;
+
+    FILE *file;
+    size_t cap;
+    char *line;
+    size_t line_cap;
+};
+
+static int cgrow(struct pbo_cursor *cur, size_t len) {
+    if(cur->cap - cur->len >= len) {
+        return 0;
+    }
+
+    size_t cap = cur->cap > 0 ? cur->cap : 65536;
+    while(cap - cur->len < len) {
+        if(__builtin_mul_overflow(cap, 2, &cap)) {
+            return ENOMEM;
+        }
+    }
+
+    char *buf = realloc((char *) cur->buf, cap);
+    if(buf == NULL) {
+        return errno;
+    }
+
+    cur->buf = buf;
+    cur->cap = cap;
+    return 0;
+}
+
+static int cgetasciiz(struct pbo_cursor *cur, const char **str, size_t len) {
+    int status;
+
+    if(cur->file != NULL && cur->pos == cur->len) {
+        ssize_t rlen = getdelim(&cur->line, &cur->line_cap, '\0', cur->file);
+        if(rlen <= 0 || cur->line[rlen - 1] != '\0') {
             return EIO;
         }
 
-        buf[i] = (char) c;
-        if(c == '\0') {
-            return 0;
+        status = cgrow(cur, rlen);
+        if(status != 0) {
+            return status;
         }
+
+        memcpy((char *) cur->buf + cur->len, cur->line, rlen);
+        cur->len += rlen;
+        pbo_count(PBO_COUNTER_BYTES_READ, rlen);
+    }
+
+    size_t avail = cur->len - cur->pos;
+    const char *str_start = cur->buf + cur->pos;
+    const char *nul = memchr(str_start, '\0', avail < len ? avail : len);
+    if(nul == NULL) {
+        return avail < len ? EIO : EOVERFLOW;
     }
-    
-    return EOVERFLOW;
+
+    *str = str_start;
+    cur->pos += nul + 1 - str_start;
+    return 0;
 }
 
-static int pbo_load_property(struct pbo_property *prop, FILE *file) {
+static int cgetfields(struct pbo_cursor *cur, uint32_t fields[5]) {
     int status;
 
-    char keybuf[32], valbuf[256];
-    status = fgetasciiz(file, keybuf, sizeof(keybuf));
-    if(status != 0) {
-        return status;
+    const size_t len = 5 * sizeof(uint32_t);
+    if(cur->file != NULL && cur->pos == cur->len) {
+        status = cgrow(cur, len);
+        if(status != 0) {
+            return status;
+        }
+
+        if(fread((char *) cur->buf + cur->len, len, 1, cur->file) != 1) {
+            return EIO;
+        }
+        cur->len += len;
+        pbo_count(PBO_COUNTER_BYTES_READ, len);
     }
 
-    if(strlen(keybuf) == 0) {
-        prop->key = NULL;
-        prop->value = NULL;
-        return 0;
+    if(cur->len - cur->pos < len) {
+        return EIO;
+    }
+
+    memcpy(fields, cur->buf + cur->pos, len);
+    cur->pos += len;
+
+    for(size_t i = 1; i < 5; i++) {
+        fields[i] = le32toh(fields[i]);
+    }
+
+    return 0;
+}
+
+/*
+ * The parse functions run twice per header: first with no tables to count
+ * entries and properties, then again with the tables allocated to fill them.
+ */
+
+static int pbo_parse_properties(struct pbo *pbo, struct pbo_cursor *cur) {
+    int status;
+
+    while(1) {
+        const char *key, *value;
+        status = cgetasciiz(cur, &key, 32);
+        if(status != 0) {
+            return status;
+        }
+
+        if(*key == '\0') {
+            break;
+        }
+
+        status = cgetasciiz(cur, &value, 256);
+        if(status != 0) {
+            return status;
+        }
+
+        if(pbo->properties != NULL) {
+            pbo->properties[pbo->property_count] = (struct pbo_property) {
+                .key = key,
+                .value = value,
+            };
+        }
+        pbo->property_count++;
+    }
+
+    return 0;
+}
+
+static int pbo_parse_entry(struct pbo_entry *ent, struct pbo_cursor *cur) {
+    int status;
+
+    const char *path;
+    status = cgetasciiz(cur, &path, PATH_MAX);
+    if(status != 0) {
+        return status != EOVERFLOW ? status : ENAMETOOLONG;
     }
 
-    status = fgetasciiz(file, valbuf, sizeof(valbuf));
+    // reading the fields may move the buffer of a stream-backed cursor
+    bool named = *path != '\0';
+
+    uint32_t fields[5];
+    status = cgetfields(cur, fields);
     if(status != 0) {
         return status;
     }
 
-    prop->key = strdup(keybuf);
-    if(prop->key == NULL) {
-        return errno;
+    if(memcmp(&fields[0], "\0\0\0\0", 4) == 0) {
+        ent->type = PBO_ENTRY_NULL;
+    } else if(memcmp(&fields[0], "sreV", 4) == 0) {
+        ent->type = PBO_ENTRY_VERS;
+    } else if(memcmp(&fields[0], "srpC", 4) == 0) {
+        ent->type = PBO_ENTRY_CPRS;
+    } else {
+        return EINVAL;
     }
 
-    prop->value = strdup(valbuf);
-    if(prop->value == NULL) {
-        status = errno;
-        free(prop->key);
-        return status;
+    ent->original_size = fields[1];
+    ent->offset = fields[2];
+    ent->data_size = fields[4];
+    if(__builtin_add_overflow(fields[3], 0, &ent->timestamp)) {
+        return EOVERFLOW;
     }
 
+    ent->path = named ? path : NULL;
     return 0;
 }
 
-static int pbo_load_properties(struct pbo *pbo, FILE *file) {
+static int pbo_parse_entries(struct pbo *pbo, struct pbo_cursor *cur) {
     int status;
 
-    struct pbo_property **prop_ptr = &pbo->properties;
+    pbo->entry_count = 0;
+    pbo->property_count = 0;
     while(1) {
-        struct pbo_property *prop = NULL;
-        status = pbo_property_init(&prop);
+        struct pbo_entry ent = { 0 };
+        status = pbo_parse_entry(&ent, cur);
         if(status != 0) {
             return status;
         }
 
-        status = pbo_load_property(prop, file);
-        if(status != 0) {
-            pbo_property_free(prop);
-            return status;
+        if(ent.type == PBO_ENTRY_NULL && ent.path == NULL) {
+            break;
         }
 
-        if(prop->key == NULL) {
-            status = pbo_property_free(prop);
+        if(ent.type == PBO_ENTRY_VERS) {
+            if(pbo->entry_count != 0 || ent.path != NULL) {
+                return EINVAL; // not first in header or non-null path
+            }
+
+            status = pbo_parse_properties(pbo, cur);
             if(status != 0) {
                 return status;
             }
 
-            break;
+            continue;
+        } else if(ent.path == NULL) {
+            return EINVAL; // unnamed entry that is not the terminator
         }
 
-        *prop_ptr = prop;
-        prop_ptr = &prop->next;
+        if(pbo->entries != NULL) {
+            pbo->entries[pbo->entry_count] = ent;
+        }
+        pbo->entry_count++;
     }
 
     return 0;
 }
 
-static int pbo_load_entry(struct pbo_entry *ent, FILE *file) {
+static size_t pbo_tables_size(struct pbo *pbo) {
+    return (pbo->entry_count + 1) * sizeof(struct pbo_entry) + (pbo->property_count + 1) * sizeof(struct pbo_property);
+}
+
+static int pbo_parse_tables(struct pbo *pbo, const char *buf, size_t len, void *tables) {
+    // one spare zeroed slot at the end of each table terminates iteration
+    memset(tables, 0, pbo_tables_size(pbo));
+    pbo->entries = tables;
+    pbo->properties = (struct pbo_property *) (pbo->entries + pbo->entry_count + 1);
+
+    struct pbo_cursor cur = {
+        .buf = buf,
+        .len = len,
+    };
+    return pbo_parse_entries(pbo, &cur);
+}
+
+/*
+ * Places the data of an entry at `*datapos` unless the header says where it
+ * is, and checks it lies within the `size` bytes of the file, so that reads
+ * need no checks of their own. The size of a pipe is not known up front; its
+ * ranges are only kept within what off_t can address.
+ */
+static int pbo_resolve_entry(struct pbo_entry *ent, uint64_t *datapos, off_t size) {
+    uint64_t limit = size >= 0 ? (uint64_t) size : INT64_MAX;
+
+    if(ent->offset == 0) {
+        ent->offset = *datapos;
+    } else {
+        *datapos = ent->offset;
+    }
+    if(__builtin_add_overflow(*datapos, ent->data_size, datapos)) {
+        return EOVERFLOW;
+    }
+
+    if(*datapos > limit) {
+        return size >= 0 ? EIO : EOVERFLOW;
+    }
+
+    if(ent->original_size == 0) {
+        switch(ent->type) {
+            case PBO_ENTRY_NULL:
+                ent->original_size = ent->data_size;
+                break;
+            default:
+                return ENOTSUP;
+        }
+    } else if(ent->type == PBO_ENTRY_NULL && ent->original_size != ent->data_size) {
+        // older PBOs mark compressed entries by their size alone
+        ent->type = PBO_ENTRY_CPRS;
+    }
+
+    return 0;
+}
+
+static int pbo_resolve_entries(struct pbo *pbo, uint64_t datapos, off_t size) {
     int status;
 
-    char pathbuf[PATH_MAX];
-    status = fgetasciiz(file, pathbuf, PATH_MAX);
+    pbo->data_offset = datapos;
+    for(struct pbo_entry *ent = pbo->entries; ent < pbo->entries + pbo->entry_count; ent++) {
+        status = pbo_resolve_entry(ent, &datapos, size);
+        if(status != 0) {
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+int pbo_load(struct pbo *pbo, FILE *file) {
+    int status;
+
+    if(pbo->arena != NULL) {
+        return EBUSY;
+    }
+
+    struct pbo_cursor cur = {
+        .file = file,
+    };
+
+    status = pbo_parse_entries(pbo, &cur);
+    free(cur.line);
     if(status != 0) {
-        return status != EOVERFLOW ? status : ENAMETOOLONG;
+        free((char *) cur.buf);
+        return status;
     }
 
-    uint32_t fields[5];
-    if(fread(fields, sizeof(fields), 1, file) != 1) {
-        return EIO;
+    // the header copy and the tables pointing into it share one allocation
+    size_t tables_offset = (cur.len + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+    char *arena = realloc((char *) cur.buf, tables_offset + pbo_tables_size(pbo));
+    if(arena == NULL) {
+        status = errno;
+        free((char *) cur.buf);
+        return status;
     }
+    pbo->arena = arena;
 
-    for(size_t i = 1; i < 5; i++) {
-        fields[i] = le32toh(fields[i]);
+    status = pbo_parse_tables(pbo, arena, cur.len, arena + tables_offset);
+    if(status != 0) {
+        return status;
     }
 
-    if(memcmp(&fields[0], "\0\0\0\0", 4) == 0) {
-        ent->type = PBO_ENTRY_NULL;
-    } else if(memcmp(&fields[0], "sreV", 4) == 0) {
-        ent->type = PBO_ENTRY_VERS;
+    // a pipe has consumed nothing but the header
+    off_t datapos = ftello(file), size = -1;
+    pbo_count(PBO_COUNTER_SEEK, 1);
+    if(datapos < 0 && errno == ESPIPE) {
+        datapos = cur.len;
+    } else if(datapos < 0) {
+        return errno;
     } else {
-        return EINVAL;
+        struct stat info;
+        pbo_count(PBO_COUNTER_STAT, 1);
+        if(fstat(fileno(file), &info) != 0) {
+            return errno;
+        }
+        size = S_ISREG(info.st_mode) ? info.st_size : -1;
     }
 
-    if( __builtin_add_overflow(fields[1], 0, &ent->original_size) ||
-        __builtin_add_overflow(fields[2], 0, &ent->offset)        ||
-        __builtin_add_overflow(fields[3], 0, &ent->timestamp)     ||
-        __builtin_add_overflow(fields[4], 0, &ent->data_size)) {
+    status = pbo_resolve_entries(pbo, datapos, size);
+    if(status != 0) {
+        return status;
+    }
 
-        return EOVERFLOW;
+    return 0;
+}
+
+int pbo_load_mmap(struct pbo *pbo, int fd) {
+    int status;
+
+    if(pbo->arena != NULL) {
+        return EBUSY;
+    }
+
+    struct stat info;
+    pbo_count(PBO_COUNTER_STAT, 1);
+    if(fstat(fd, &info) != 0) {
+        return errno;
+    }
+
+    if(info.st_size == 0) {
+        return EIO;
+    } else if((uint64_t) info.st_size > SIZE_MAX) {
+        return EFBIG;
+    }
+
+    void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) {
+        return errno;
+    }
+
+    pbo->map = map;
+    pbo->map_size = info.st_size;
+    pbo->map_fd = fd;
+
+    struct pbo_cursor cur = {
+        .buf = map,
+        .len = info.st_size,
+    };
+
+    status = pbo_parse_entries(pbo, &cur);
+    if(status != 0) {
+        return status;
+    }
+
+    pbo->arena = malloc(pbo_tables_size(pbo));
+    if(pbo->arena == NULL) {
+        return errno;
+    }
+
+    status = pbo_parse_tables(pbo, map, cur.pos, pbo->arena);
+    if(status != 0) {
+        return status;
+    }
+
+    status = pbo_resolve_entries(pbo, cur.pos, info.st_size);
+    if(status != 0) {
+        return status;
+    }
+
+    for(struct pbo_entry *ent = pbo->entries; ent < pbo->entries + pbo->entry_count; ent++) {
+        ent->data = (const char *) map + ent->offset;
+        ent->origin = pbo;
+    }
+
+    return 0;
+}
+
+/*
+ * pbo_scan() reads the header through a window of fixed size that is topped
+ * up before each record, so that a whole record is always in memory and can
+ * be parsed by a cursor without a stream behind it.
+ */
+
+#define PBO_SCAN_BUFFER (1 << 20)
+#define PBO_SCAN_RECORD (PATH_MAX + 5 * sizeof(uint32_t))
+
+struct pbo_scan_window {
+    int fd;
+    bool seekable; // read with pread() from `base` on
+    off_t base; // position of the window in the input
+    char *buf;
+    size_t pos, len;
+    bool eof;
+};
+
+static int pbo_scan_fill(struct pbo_scan_window *win) {
+    if(win->eof || win->len - win->pos >= PBO_SCAN_RECORD) {
+        return 0;
     }
 
-    if(strlen(pathbuf) > 0) {
-        ent->path = strdup(pathbuf);
-        if(ent->path == NULL) {
+    memmove(win->buf, win->buf + win->pos, win->len - win->pos);
+    win->base += win->pos;
+    win->len -= win->pos;
+    win->pos = 0;
+
+    while(!win->eof && win->len < PBO_SCAN_RECORD) {
+        char *dst = win->buf + win->len;
+        size_t room = PBO_SCAN_BUFFER - win->len;
+        ssize_t rlen = win->seekable ? pread(win->fd, dst, room, win->base + win->len) : read(win->fd, dst, room);
+        if(rlen < 0 && errno == EINTR) {
+            continue;
+        } else if(rlen < 0) {
             return errno;
         }
-    } else{
-        ent->path = NULL;
+
+        win->len += rlen;
+        win->eof = rlen == 0;
+        pbo_count(PBO_COUNTER_READ, 1);
+        pbo_count(PBO_COUNTER_BYTES_READ, rlen);
     }
 
     return 0;
 }
 
-static int pbo_load_entries(struct pbo *pbo, FILE *file) {
+static int pbo_scan_properties(struct pbo_scan_window *win, const struct pbo_scan_callbacks *callbacks, void *ctx) {
     int status;
 
-    struct pbo_entry **ent_ptr = &pbo->entries;
     while(1) {
-        struct pbo_entry *ent = NULL;
-        status = pbo_entry_init(&ent);
+        status = pbo_scan_fill(win);
         if(status != 0) {
             return status;
         }
 
-        status = pbo_load_entry(ent, file);
+        struct pbo_cursor cur = {
+            .buf = win->buf,
+            .pos = win->pos,
+            .len = win->len,
+        };
+
+        const char *key, *value;
+        status = cgetasciiz(&cur, &key, 32);
         if(status != 0) {
-            pbo_entry_free(ent);
             return status;
         }
 
-        if(ent->type == PBO_ENTRY_NULL && ent->path == NULL) {
-            status = pbo_entry_free(ent);
+        if(*key == '\0') {
+            win->pos = cur.pos;
+            return 0;
+        }
+
+        status = cgetasciiz(&cur, &value, 256);
+        if(status != 0) {
+            return status;
+        }
+        win->pos = cur.pos;
+
+        if(callbacks != NULL && callbacks->property != NULL) {
+            status = callbacks->property(ctx, key, value);
             if(status != 0) {
                 return status;
             }
+        }
+    }
+}
+
+/*
+ * One pass over the header from the start of the window. Without callbacks
+ * it only finds where the header ends, which is where the data starts.
+ */
+static int pbo_scan_pass(struct pbo_scan_window *win, const struct pbo_scan_callbacks *callbacks, void *ctx, uint64_t datapos, off_t size, uint64_t *end) {
+    int status;
+
+    bool first = true;
+    while(1) {
+        status = pbo_scan_fill(win);
+        if(status != 0) {
+            return status;
+        }
+
+        struct pbo_cursor cur = {
+            .buf = win->buf,
+            .pos = win->pos,
+            .len = win->len,
+        };
+
+        struct pbo_entry ent = { 0 };
+        status = pbo_parse_entry(&ent, &cur);
+        if(status != 0) {
+            return status;
+        }
+        win->pos = cur.pos;
 
+        if(ent.type == PBO_ENTRY_NULL && ent.path == NULL) {
             break;
         }
 
-        if(ent->type == PBO_ENTRY_VERS) {
-            if(ent_ptr != &pbo->entries || ent->path != NULL) {
-                pbo_entry_free(ent);
+        if(ent.type == PBO_ENTRY_VERS) {
+            if(!first || ent.path != NULL) {
                 return EINVAL; // not first in header or non-null path
             }
-            
-            status = pbo_entry_free(ent);
+
+            status = pbo_scan_properties(win, callbacks, ctx);
             if(status != 0) {
                 return status;
             }
 
-            status = pbo_load_properties(pbo, file);
+            continue;
+        } else if(ent.path == NULL) {
+            return EINVAL; // unnamed entry that is not the terminator
+        }
+        first = false;
+
+        status = pbo_resolve_entry(&ent, &datapos, size);
+        if(status != 0) {
+            return status;
+        }
+
+        if(callbacks != NULL && callbacks->entry != NULL) {
+            status = callbacks->entry(ctx, &ent);
             if(status != 0) {
                 return status;
             }
-
-            continue;
         }
+    }
+
+    *end = win->base + win->pos;
+    return 0;
+}
+
+int pbo_scan(int fd, const struct pbo_scan_callbacks *callbacks, void *ctx) {
+    int status;
 
-        *ent_ptr = ent;
-        ent_ptr = &ent->next;
+    struct stat info;
+    pbo_count(PBO_COUNTER_STAT, 1);
+    if(fstat(fd, &info) != 0) {
+        return errno;
     }
 
-    long datapos = ftell(file);
-    if(datapos < 0) {
+    struct pbo_scan_window win = {
+        .fd = fd,
+        .seekable = S_ISREG(info.st_mode),
+    };
+
+    off_t size = -1;
+    if(win.seekable) {
+        pbo_count(PBO_COUNTER_SEEK, 1);
+        win.base = lseek(fd, 0, SEEK_CUR);
+        if(win.base < 0) {
+            return errno;
+        }
+        size = info.st_size;
+    }
+
+    win.buf = malloc(PBO_SCAN_BUFFER);
+    if(win.buf == NULL) {
         return errno;
     }
 
-    for(struct pbo_entry *ent = pbo->entries; ent != NULL; ent = ent->next) {
-        if(ent->offset == 0) {
-            ent->offset = datapos;
+    // entry data can only be placed up front if the header can be read twice
+    uint64_t datapos = 0;
+    status = 0;
+    if(win.seekable) {
+        off_t start = win.base;
+        status = pbo_scan_pass(&win, NULL, NULL, 0, -1, &datapos);
+        if(win.base == start) {
+            win.pos = 0; // the header is still in the window
         } else {
-            datapos = ent->offset;
+            win.base = start;
+            win.pos = win.len = 0;
+            win.eof = false;
         }
-        datapos += ent->data_size;
+    }
 
-        if(ent->original_size == 0) {
-            switch(ent->type) {
-                case PBO_ENTRY_NULL:
-                    ent->original_size = ent->data_size;
-                    break;
-                default:
-                    return ENOTSUP;
-            }
+    uint64_t end;
+    if(status == 0) {
+        status = pbo_scan_pass(&win, callbacks, ctx, datapos, size, &end);
+    }
+
+    free(win.buf);
+    return status;
+}
+
+/*
+ * Finishes an extracted file, stamping it with the entry timestamp so that
+ * later incremental runs can tell it is up to date.
+ */
+static int pbo_output_close(struct pbo_entry *ent, int outfd) {
+    pbo_io_written(outfd);
+
+    if(ent->timestamp != 0) {
+        const struct timespec times[2] = {
+            { .tv_nsec = UTIME_OMIT },
+            { .tv_sec = ent->timestamp },
+        };
+        if(futimens(outfd, times) != 0) {
+            int status = errno;
+            close(outfd);
+            return status;
         }
     }
 
+    if(close(outfd) != 0) {
+        return errno;
+    }
     return 0;
 }
 
-int pbo_load(struct pbo *pbo, FILE *file) {
+static int pbo_entry_extract_regular(struct pbo_entry *ent, int pbofd, int dirfd, const char *name) {
     int status;
 
-    status = pbo_load_entries(pbo, file);
+    pbo_count(PBO_COUNTER_OPEN, 1);
+
+    int outfd = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 00666);
+    if(outfd < 0) {
+        return errno;
+    }
+
+    status = pbo_copy_range(pbofd, ent->offset, outfd, 0, ent->data_size);
     if(status != 0) {
+        close(outfd);
         return status;
     }
 
+    return pbo_output_close(ent, outfd);
+}
+
+static int pbo_write_all(int fd, const void *buf, size_t len) {
+    pbo_io_throttle(len);
+    for(size_t written = 0; written < len;) {
+        ssize_t wlen = write(fd, (const char *) buf + written, len - written);
+        if(wlen < 0) {
+            return errno;
+        }
+        written += wlen;
+        pbo_count(PBO_COUNTER_WRITE, 1);
+        pbo_count(PBO_COUNTER_BYTES_WRITTEN, wlen);
+    }
     return 0;
 }
 
-static int fcopy(FILE *in, FILE *out, long len) {
-    if(len < 0) {
-        return EINVAL;
+struct pbo_stream {
+    FILE *file;
+    size_t remaining;
+};
+
+static ssize_t pbo_stream_read(void *ctx, void *buf, size_t len) {
+    struct pbo_stream *stream = ctx;
+
+    if(len > stream->remaining) {
+        len = stream->remaining;
+    }
+    if(len == 0) {
+        return 0;
     }
 
-    long total = 0;
-    char iobuf[BUFSIZ];
-    while(total < len) {
-        long maxrlen = len - total;
-        size_t rlen = maxrlen > BUFSIZ ? BUFSIZ : maxrlen;
-        rlen = fread(iobuf, 1, rlen, in);
-        if(rlen == 0) {
-            return EIO;
+    size_t rlen = fread(buf, 1, len, stream->file);
+    if(rlen == 0 && ferror(stream->file)) {
+        errno = EIO;
+        return -1;
+    }
+    stream->remaining -= rlen;
+    pbo_count(PBO_COUNTER_READ, 1);
+    pbo_count(PBO_COUNTER_BYTES_READ, rlen);
+    return rlen;
+}
+
+struct pbo_range {
+    int fd;
+    off_t offset;
+    size_t remaining;
+};
+
+static ssize_t pbo_range_read(void *ctx, void *buf, size_t len) {
+    struct pbo_range *range = ctx;
+
+    if(len > range->remaining) {
+        len = range->remaining;
+    }
+    if(len == 0) {
+        return 0;
+    }
+
+    ssize_t rlen = pread(range->fd, buf, len, range->offset);
+    if(rlen > 0) {
+        range->offset += rlen;
+        range->remaining -= rlen;
+    }
+    pbo_count(PBO_COUNTER_READ, 1);
+    pbo_count(PBO_COUNTER_BYTES_READ, rlen > 0 ? rlen : 0);
+    return rlen;
+}
+
+static int pbo_entry_decompress(struct pbo_entry *ent, ssize_t (*read)(void *ctx, void *buf, size_t len), void *ctx, int dirfd, const char *name) {
+    int status;
+
+    struct pbo_lzss *lz;
+    status = pbo_lzss_init(&lz, ent->original_size, read, ctx);
+    if(status != 0) {
+        return status;
+    }
+
+    pbo_count(PBO_COUNTER_OPEN, 1);
+
+    int outfd = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 00666);
+    if(outfd < 0) {
+        status = errno;
+        pbo_lzss_free(lz);
+        return status;
+    }
+
+    while(1) {
+        char iobuf[PBO_LZSS_CHUNK];
+        size_t rlen;
+        status = pbo_lzss_read(lz, iobuf, sizeof(iobuf), &rlen);
+        if(status != 0 || rlen == 0) {
+            break;
         }
 
-        size_t wlen = fwrite(iobuf, 1, rlen, out);
-        if(wlen < rlen) {
-            return EIO;
+        status = pbo_write_all(outfd, iobuf, rlen);
+        if(status != 0) {
+            break;
         }
+    }
 
-        total += wlen;
+    pbo_lzss_free(lz);
+    if(status != 0) {
+        close(outfd);
+        return status;
     }
 
-    return 0;
+    return pbo_output_close(ent, outfd);
 }
 
-static int pbo_entry_extract_regular(struct pbo_entry *ent, FILE *pbofile) {
+static int pbo_entry_extract_compressed(struct pbo_entry *ent, int pbofd, int dirfd, const char *name) {
     int status;
 
-    char pathbuf[PATH_MAX];
-    if(stpncpy(pathbuf, ent->path, PATH_MAX) >= (pathbuf + PATH_MAX)) {
-        return ENAMETOOLONG;
+    struct pbo_range range = {
+        .fd = pbofd,
+        .offset = ent->offset,
+        .remaining = ent->data_size,
+    };
+
+    pbo_io_willneed(pbofd, ent->offset, ent->data_size);
+    status = pbo_entry_decompress(ent, pbo_range_read, &range, dirfd, name);
+    pbo_io_dontneed(pbofd, ent->offset, ent->data_size);
+    return status;
+}
+
+int pbo_entry_extract_at(struct pbo_entry *ent, int pbofd, int dirfd, const char *name) {
+    switch(ent->type) {
+        case PBO_ENTRY_NULL:
+            return pbo_entry_extract_regular(ent, pbofd, dirfd, name);
+        case PBO_ENTRY_CPRS:
+            return pbo_entry_extract_compressed(ent, pbofd, dirfd, name);
+        default:
+            return ENOTSUP;
     }
+}
 
-    for(char *sep = strstr(pathbuf, PBO_PATH_SEPARATOR); sep != NULL; sep = strstr(++sep, PBO_PATH_SEPARATOR)) {
-        *sep = '\0';
+// bigger entries are left to pbo_copy_range(), which need not buffer them
+#define PBO_BATCH_ENTRY_MAX (256 << 10)
+#define PBO_BATCH_BUFFER (16 << 20)
 
-        struct stat dirinfo;
-        if(stat(pathbuf, &dirinfo) != 0) {
-            if(errno == ENOENT) {
-                if(mkdir(pathbuf, 00777) != 0) {
-                    return errno;
+// files closed by the ring could not be paced or dropped from the cache
+static bool pbo_batchable(const struct pbo_entry *ent) {
+    return ent->type == PBO_ENTRY_NULL && ent->data_size <= PBO_BATCH_ENTRY_MAX && !pbo_io_paced();
+}
+
+/*
+ * Runs one batch of requests through the ring, buffering the data of
+ * unmapped entries in `buf`. Requests that fail are retried one by one, so
+ * they report the same errors as without a ring.
+ */
+static int pbo_extract_batch(struct pbo_uring *ring, struct pbo_extract_request *requests, struct pbo_uring_op *ops, size_t *indices, size_t count, char *buf) {
+    int status;
+
+    size_t used = 0;
+    for(size_t i = 0; i < count; i++) {
+        struct pbo_extract_request *req = &requests[indices[i]];
+        struct pbo_entry *ent = req->ent;
+
+        ops[i] = (struct pbo_uring_op) {
+            .dirfd = req->dirfd,
+            .path = req->name,
+            .flags = O_WRONLY | O_CREAT | O_TRUNC,
+            .buf = (void *) ent->data,
+            .len = ent->data_size,
+            .srcfd = -1,
+        };
+        if(ent->data == NULL) {
+            ops[i].buf = buf + used;
+            ops[i].srcfd = req->pbofd;
+            ops[i].srcoff = ent->offset;
+            used += ent->data_size;
+        }
+    }
+
+    // operations the ring did not run are extracted the usual way
+    status = pbo_uring_run(ring, ops, count);
+
+    for(size_t i = 0; i < count; i++) {
+        struct pbo_extract_request *req = &requests[indices[i]];
+        if(ops[i].status != 0) {
+            req->status = pbo_entry_extract_at(req->ent, req->pbofd, req->dirfd, req->name);
+            continue;
+        }
+
+        req->status = 0;
+        if(req->ent->timestamp != 0) {
+            const struct timespec times[2] = {
+                { .tv_nsec = UTIME_OMIT },
+                { .tv_sec = req->ent->timestamp },
+            };
+            if(utimensat(req->dirfd, req->name, times, 0) != 0) {
+                req->status = errno;
+            }
+        }
+    }
+
+    return status;
+}
+
+int pbo_entries_extract_at(struct pbo_extract_request *requests, size_t count) {
+    int status;
+
+    struct pbo_uring *ring;
+    if(pbo_uring_init(&ring) != 0) {
+        for(size_t i = 0; i < count; i++) {
+            struct pbo_extract_request *req = &requests[i];
+            req->status = pbo_entry_extract_at(req->ent, req->pbofd, req->dirfd, req->name);
+        }
+        return 0;
+    }
+
+    struct pbo_uring_op *ops = malloc((count > 0 ? count : 1) * sizeof(struct pbo_uring_op));
+    size_t *indices = malloc((count > 0 ? count : 1) * sizeof(size_t));
+    char *buf = malloc(PBO_BATCH_BUFFER);
+    if(ops == NULL || indices == NULL || buf == NULL) {
+        status = errno;
+        free(ops);
+        free(indices);
+        free(buf);
+        pbo_uring_destroy(ring);
+        return status;
+    }
+
+    size_t i = 0;
+    status = 0;
+    while(i < count && status == 0) {
+        size_t batched = 0, buffered = 0;
+        for(; i < count; i++) {
+            struct pbo_extract_request *req = &requests[i];
+            if(!pbo_batchable(req->ent)) {
+                req->status = pbo_entry_extract_at(req->ent, req->pbofd, req->dirfd, req->name);
+                continue;
+            }
+
+            if(req->ent->data == NULL) {
+                if(buffered + req->ent->data_size > PBO_BATCH_BUFFER) {
+                    break;
                 }
-            } else {
+                buffered += req->ent->data_size;
+            }
+            indices[batched++] = i;
+        }
+
+        status = pbo_extract_batch(ring, requests, ops, indices, batched, buf);
+    }
+
+    // a ring that failed leaves the rest of the requests to blocking I/O
+    for(; i < count; i++) {
+        struct pbo_extract_request *req = &requests[i];
+        req->status = pbo_entry_extract_at(req->ent, req->pbofd, req->dirfd, req->name);
+    }
+
+    free(ops);
+    free(indices);
+    free(buf);
+    pbo_uring_destroy(ring);
+    return 0;
+}
+
+int pbo_entry_extract_stream(struct pbo_entry *ent, FILE *pbofile, int dirfd, const char *name) {
+    int status;
+
+    struct pbo_stream stream = {
+        .file = pbofile,
+        .remaining = ent->data_size,
+    };
+
+    switch(ent->type) {
+        case PBO_ENTRY_NULL: {
+            pbo_count(PBO_COUNTER_OPEN, 1);
+            int outfd = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 00666);
+            if(outfd < 0) {
                 return errno;
             }
-        } else if(!S_ISDIR(dirinfo.st_mode)) {
-            return ENOTDIR;
+
+            status = 0;
+            while(stream.remaining > 0 && status == 0) {
+                char iobuf[PBO_LZSS_CHUNK];
+                ssize_t rlen = pbo_stream_read(&stream, iobuf, sizeof(iobuf));
+                if(rlen <= 0) {
+                    status = rlen < 0 ? errno : EIO;
+                    break;
+                }
+                status = pbo_write_all(outfd, iobuf, rlen);
+            }
+
+            if(status != 0) {
+                close(outfd);
+                return status;
+            }
+
+            status = pbo_output_close(ent, outfd);
+            if(status != 0) {
+                return status;
+            }
+            break;
         }
+        case PBO_ENTRY_CPRS:
+            status = pbo_entry_decompress(ent, pbo_stream_read, &stream, dirfd, name);
+            if(status != 0) {
+                return status;
+            }
+            break;
+        default:
+            return ENOTSUP;
+    }
 
-        memcpy(sep, "/", strlen("/"));
+    // leave the stream at the end of the entry even if the data had slack
+    while(stream.remaining > 0) {
+        char iobuf[4096];
+        ssize_t rlen = pbo_stream_read(&stream, iobuf, sizeof(iobuf));
+        if(rlen <= 0) {
+            return rlen < 0 ? errno : EIO;
+        }
     }
 
-    FILE *outfile = fopen(pathbuf, "w");
-    if(outfile == NULL) {
+    return 0;
+}
+
+struct pbo_reader {
+    struct pbo_range range;
+    struct pbo_lzss *lz; // NULL for stored entries
+};
+
+int pbo_entry_open(struct pbo_entry *ent, int pbofd, struct pbo_reader **reader_ptr) {
+    int status;
+
+    if(ent->type != PBO_ENTRY_NULL && ent->type != PBO_ENTRY_CPRS) {
+        return ENOTSUP;
+    }
+
+    struct pbo_reader *reader = calloc(1, sizeof(struct pbo_reader));
+    if(reader == NULL) {
         return errno;
     }
 
-    if(fseek(pbofile, ent->offset, SEEK_SET) != 0) {
-        status = errno;
-        fclose(outfile);
+    reader->range = (struct pbo_range) {
+        .fd = pbofd,
+        .offset = ent->offset,
+        .remaining = ent->data_size,
+    };
+
+    if(ent->type == PBO_ENTRY_CPRS) {
+        status = pbo_lzss_init(&reader->lz, ent->original_size, pbo_range_read, &reader->range);
+        if(status != 0) {
+            free(reader);
+            return status;
+        }
+    }
+
+    *reader_ptr = reader;
+    return 0;
+}
+
+int pbo_reader_read(struct pbo_reader *reader, void *buf, size_t len, size_t *rlen) {
+    if(reader->lz != NULL) {
+        return pbo_lzss_read(reader->lz, buf, len, rlen);
+    }
+
+    ssize_t status = pbo_range_read(&reader->range, buf, len);
+    if(status < 0) {
+        return errno;
+    } else if(status == 0 && reader->range.remaining > 0 && len > 0) {
+        return EIO; // the PBO is shorter than its header says
+    }
+
+    *rlen = status;
+    return 0;
+}
+
+void pbo_reader_close(struct pbo_reader *reader) {
+    if(reader->lz != NULL) {
+        pbo_lzss_free(reader->lz);
+    }
+    free(reader);
+}
+
+static int pbo_entry_read_stored(struct pbo_entry *ent, int pbofd, void *buf, size_t len, off_t offset, size_t *rlen) {
+    if((uint64_t) offset >= ent->data_size) {
+        *rlen = 0;
+        return 0;
+    }
+    if(len > ent->data_size - offset) {
+        len = ent->data_size - offset;
+    }
+
+    if(ent->data != NULL) {
+        memcpy(buf, (const char *) ent->data + offset, len);
+        *rlen = len;
+        return 0;
+    }
+
+    struct pbo_range range = {
+        .fd = pbofd,
+        .offset = ent->offset + offset,
+        .remaining = len,
+    };
+    for(size_t done = 0; done < len;) {
+        ssize_t status = pbo_range_read(&range, (char *) buf + done, len - done);
+        if(status < 0) {
+            return errno;
+        } else if(status == 0) {
+            return EIO; // the PBO is shorter than its header says
+        }
+        done += status;
+    }
+
+    *rlen = len;
+    return 0;
+}
+
+int pbo_entry_read(struct pbo_entry *ent, int pbofd, void *buf, size_t len, off_t offset, size_t *rlen) {
+    int status;
+
+    if(offset < 0) {
+        return EINVAL;
+    }
+
+    if(ent->type == PBO_ENTRY_NULL) {
+        return pbo_entry_read_stored(ent, pbofd, buf, len, offset, rlen);
+    } else if(ent->type != PBO_ENTRY_CPRS) {
+        return ENOTSUP;
+    }
+
+    if((uint64_t) offset >= ent->original_size) {
+        *rlen = 0;
+        return 0;
+    }
+
+    struct pbo_reader *reader;
+    status = pbo_entry_open(ent, pbofd, &reader);
+    if(status != 0) {
         return status;
     }
 
-    status = fcopy(pbofile, outfile, ent->data_size);
+    // compressed data can only be decoded from the start
+    if(offset > 0) {
+        char *skip = malloc(PBO_LZSS_CHUNK);
+        if(skip == NULL) {
+            status = errno;
+        }
+        while(status == 0 && offset > 0) {
+            size_t skipped;
+            status = pbo_reader_read(reader, skip, offset < PBO_LZSS_CHUNK ? (size_t) offset : PBO_LZSS_CHUNK, &skipped);
+            if(status == 0 && skipped == 0) {
+                status = EIO;
+            } else if(status == 0) {
+                offset -= skipped;
+            }
+        }
+        free(skip);
+    }
+
+    size_t done = 0;
+    while(status == 0 && done < len) {
+        size_t chunk;
+        status = pbo_reader_read(reader, (char *) buf + done, len - done, &chunk);
+        if(status != 0 || chunk == 0) {
+            break;
+        }
+        done += chunk;
+    }
+
+    pbo_reader_close(reader);
     if(status != 0) {
-        fclose(outfile);
         return status;
     }
 
-    if(fclose(outfile) != 0) {
-        return errno;
+    *rlen = done;
+    return 0;
+}
+
+int pbo_entry_hash(struct pbo_entry *ent, int pbofd, unsigned char digest[PBO_DIGEST_SIZE]) {
+    struct pbo_sha1 sha;
+    pbo_sha1_init(&sha);
+
+    if(ent->data != NULL) {
+        pbo_sha1_update(&sha, ent->data, ent->data_size);
+        pbo_sha1_final(&sha, digest);
+        return 0;
     }
 
+    struct pbo_range range = {
+        .fd = pbofd,
+        .offset = ent->offset,
+        .remaining = ent->data_size,
+    };
+
+    while(range.remaining > 0) {
+        char iobuf[PBO_LZSS_CHUNK];
+        ssize_t rlen = pbo_range_read(&range, iobuf, sizeof(iobuf));
+        if(rlen <= 0) {
+            return rlen < 0 ? errno : EIO;
+        }
+        pbo_sha1_update(&sha, iobuf, rlen);
+    }
+
+    pbo_sha1_final(&sha, digest);
     return 0;
 }
 
-int pbo_entry_extract(struct pbo_entry *ent, FILE *pbofile) {
-    switch(ent->type) {
-        case PBO_ENTRY_NULL:
-            return pbo_entry_extract_regular(ent, pbofile);
-        default:
-            return ENOTSUP;
+int pbo_entry_extract_fd(struct pbo_entry *ent, int pbofd) {
+    char pathbuf[PATH_MAX];
+    if(stpncpy(pathbuf, ent->path, PATH_MAX) >= (pathbuf + PATH_MAX)) {
+        return ENAMETOOLONG;
+    }
+
+    for(char *sep = strstr(pathbuf, PBO_PATH_SEPARATOR); sep != NULL; sep = strstr(++sep, PBO_PATH_SEPARATOR)) {
+        *sep = '\0';
+
+        struct stat dirinfo;
+        pbo_count(PBO_COUNTER_STAT, 1);
+        if(stat(pathbuf, &dirinfo) != 0) {
+            if(errno != ENOENT) {
+                return errno;
+            }
+
+            // may race with another thread extracting into the same directory
+            pbo_count(PBO_COUNTER_MKDIR, 1);
+            if(mkdir(pathbuf, 00777) != 0 && errno != EEXIST) {
+                return errno;
+            }
+        } else if(!S_ISDIR(dirinfo.st_mode)) {
+            return ENOTDIR;
+        }
+
+        memcpy(sep, "/", strlen("/"));
     }
+
+    return pbo_entry_extract_at(ent, pbofd, AT_FDCWD, pathbuf);
+}
+
+int pbo_entry_extract(struct pbo_entry *ent, FILE *pbofile) {
+    return pbo_entry_extract_fd(ent, fileno(pbofile));
 }
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <endian.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA1_HAVE_SHANI 1
+#endif
+
+#include "pbofile.h"
+
+typedef void sha1_blocks_fn(uint32_t state[5], const unsigned char *data, size_t blocks);
+
+static inline uint32_t rol32(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_blocks_scalar(uint32_t state[5], const unsigned char *data, size_t blocks) {
+    for(; blocks > 0; blocks--, data += 64) {
+        uint32_t w[80];
+        for(int i = 0; i < 16; i++) {
+            uint32_t word;
+            memcpy(&word, data + 4 * i, sizeof(word));
+            w[i] = be32toh(word);
+        }
+        for(int i = 16; i < 80; i++) {
+            w[i] = rol32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+#define SHA1_ROUND(f, k, i) do { \
+            uint32_t t = rol32(a, 5) + (f) + e + (k) + w[i]; \
+            e = d; \
+            d = c; \
+            c = rol32(b, 30); \
+            b = a; \
+            a = t; \
+        } while(0)
+
+        for(int i = 0; i < 20; i++) {
+            SHA1_ROUND((b & c) | (~b & d), 0x5A827999, i);
+        }
+        for(int i = 20; i < 40; i++) {
+            SHA1_ROUND(b ^ c ^ d, 0x6ED9EBA1, i);
+        }
+        for(int i = 40; i < 60; i++) {
+            SHA1_ROUND((b & c) | (b & d) | (c & d), 0x8F1BBCDC, i);
+        }
+        for(int i = 60; i < 80; i++) {
+            SHA1_ROUND(b ^ c ^ d, 0xCA62C1D6, i);
+        }
+
+#undef SHA1_ROUND
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+#ifdef SHA1_HAVE_SHANI
+/*
+ * One four round step of the SHA-NI schedule: fold message word k into the
+ * rounds while advancing the schedule of the words after it.
+ */
+#define SHA1_SHANI_STEP(f, e, enext, m, m1, m2, m3) do { \
+            e = _mm_sha1nexte_epu32(e, m); \
+            enext = abcd; \
+            m1 = _mm_sha1msg2_epu32(m1, m); \
+            abcd = _mm_sha1rnds4_epu32(abcd, e, f); \
+            m3 = _mm_sha1msg1_epu32(m3, m); \
+            m2 = _mm_xor_si128(m2, m); \
+        } while(0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_blocks_shani(uint32_t state[5], const unsigned char *data, size_t blocks) {
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607LL, 0x08090A0B0C0D0E0FLL);
+
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0x1B);
+    __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0), e1;
+
+    for(; blocks > 0; blocks--, data += 64) {
+        __m128i abcd_save = abcd, e0_save = e0;
+
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 0)), mask);
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16)), mask);
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 32)), mask);
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 48)), mask);
+
+        // rounds 0-15 while the schedule is still being loaded
+        e0 = _mm_add_epi32(e0, m0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        e1 = _mm_sha1nexte_epu32(e1, m1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        m0 = _mm_sha1msg1_epu32(m0, m1);
+
+        e0 = _mm_sha1nexte_epu32(e0, m2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        m1 = _mm_sha1msg1_epu32(m1, m2);
+        m0 = _mm_xor_si128(m0, m2);
+
+        SHA1_SHANI_STEP(0, e1, e0, m3, m0, m1, m2);
+
+        // rounds 16-79
+        SHA1_SHANI_STEP(0, e0, e1, m0, m1, m2, m3);
+        SHA1_SHANI_STEP(1, e1, e0, m1, m2, m3, m0);
+        SHA1_SHANI_STEP(1, e0, e1, m2, m3, m0, m1);
+        SHA1_SHANI_STEP(1, e1, e0, m3, m0, m1, m2);
+        SHA1_SHANI_STEP(1, e0, e1, m0, m1, m2, m3);
+        SHA1_SHANI_STEP(1, e1, e0, m1, m2, m3, m0);
+        SHA1_SHANI_STEP(2, e0, e1, m2, m3, m0, m1);
+        SHA1_SHANI_STEP(2, e1, e0, m3, m0, m1, m2);
+        SHA1_SHANI_STEP(2, e0, e1, m0, m1, m2, m3);
+        SHA1_SHANI_STEP(2, e1, e0, m1, m2, m3, m0);
+        SHA1_SHANI_STEP(2, e0, e1, m2, m3, m0, m1);
+        SHA1_SHANI_STEP(3, e1, e0, m3, m0, m1, m2);
+        SHA1_SHANI_STEP(3, e0, e1, m0, m1, m2, m3);
+        SHA1_SHANI_STEP(3, e1, e0, m1, m2, m3, m0);
+        SHA1_SHANI_STEP(3, e0, e1, m2, m3, m0, m1);
+        SHA1_SHANI_STEP(3, e1, e0, m3, m0, m1, m2);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = _mm_extract_epi32(e0, 3);
+}
+
+#undef SHA1_SHANI_STEP
+#endif
+
+static sha1_blocks_fn *_Atomic sha1_impl = NULL;
+
+static sha1_blocks_fn *sha1_select(void) {
+    sha1_blocks_fn *impl = atomic_load_explicit(&sha1_impl, memory_order_relaxed);
+    if(impl != NULL) {
+        return impl;
+    }
+
+    impl = sha1_blocks_scalar;
+#ifdef SHA1_HAVE_SHANI
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+        impl = sha1_blocks_shani;
+    }
+#endif
+
+    atomic_store_explicit(&sha1_impl, impl, memory_order_relaxed);
+    return impl;
+}
+
+const char * pbo_sha1_impl(void) {
+    return sha1_select() == sha1_blocks_scalar ? "scalar" : "sha-ni";
+}
+
+void pbo_sha1_init(struct pbo_sha1 *sha) {
+    sha->blocks = sha1_select();
+    sha->state[0] = 0x67452301;
+    sha->state[1] = 0xEFCDAB89;
+    sha->state[2] = 0x98BADCFE;
+    sha->state[3] = 0x10325476;
+    sha->state[4] = 0xC3D2E1F0;
+    sha->len = 0;
+    sha->buflen = 0;
+}
+
+void pbo_sha1_update(struct pbo_sha1 *sha, const void *data, size_t len) {
+    const unsigned char *in = data;
+    sha->len += len;
+
+    if(sha->buflen > 0) {
+        size_t take = 64 - sha->buflen < len ? 64 - sha->buflen : len;
+        memcpy(sha->buf + sha->buflen, in, take);
+        sha->buflen += take;
+        in += take;
+        len -= take;
+
+        if(sha->buflen < 64) {
+            return;
+        }
+        sha->blocks(sha->state, sha->buf, 1);
+        sha->buflen = 0;
+    }
+
+    sha->blocks(sha->state, in, len / 64);
+    in += len - len % 64;
+    len %= 64;
+
+    memcpy(sha->buf, in, len);
+    sha->buflen = len;
+}
+
+void pbo_sha1_final(struct pbo_sha1 *sha, unsigned char digest[PBO_SHA1_SIZE]) {
+    uint64_t bits = htobe64(sha->len * 8);
+
+    sha->buf[sha->buflen++] = 0x80;
+    if(sha->buflen > 56) {
+        memset(sha->buf + sha->buflen, 0, 64 - sha->buflen);
+        sha->blocks(sha->state, sha->buf, 1);
+        sha->buflen = 0;
+    }
+    memset(sha->buf + sha->buflen, 0, 56 - sha->buflen);
+    memcpy(sha->buf + 56, &bits, sizeof(bits));
+    sha->blocks(sha->state, sha->buf, 1);
+
+    for(int i = 0; i < 5; i++) {
+        uint32_t word = htobe32(sha->state[i]);
+        memcpy(digest + 4 * i, &word, sizeof(word));
+    }
+}
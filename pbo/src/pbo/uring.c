@@ -0,0 +1,402 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pbofile.h"
+
+static atomic_uint pbo_uring_depth;
+
+#ifdef PBO_HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * A minimal io_uring driven through the raw system calls. Each operation is
+ * a chain of linked requests on one file: open into a registered slot, read
+ * or write, and close the slot. The close is hard-linked so that it runs
+ * even when the transfer fails, and the slot is free again once its chain
+ * has completed. Up to `depth` chains are in flight, refilled as they finish.
+ */
+
+#define PBO_URING_STEPS 4 // most requests in a chain
+
+struct pbo_uring {
+    int fd;
+    unsigned depth;
+
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    _Atomic unsigned *sq_head, *sq_tail;
+    unsigned *sq_array, sq_mask;
+    _Atomic unsigned *cq_head, *cq_tail;
+    struct io_uring_cqe *cqes;
+    unsigned cq_mask;
+
+    unsigned *slot_pending; // requests of the chain in each slot not yet completed
+};
+
+static int pbo_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int pbo_uring_enter(int fd, unsigned submit, unsigned wait) {
+    return syscall(__NR_io_uring_enter, fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static int pbo_uring_register(int fd, unsigned opcode, void *arg, unsigned count) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static bool pbo_uring_supported(int fd) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if(probe == NULL) {
+        return false;
+    }
+
+    bool supported = pbo_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    static const unsigned ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE };
+    for(size_t i = 0; i < sizeof(ops) / sizeof(ops[0]) && supported; i++) {
+        supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    free(probe);
+    return supported;
+}
+
+void pbo_uring_destroy(struct pbo_uring *ring) {
+    if(ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if(ring->cq_map != NULL && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if(ring->sq_map != NULL) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if(ring->fd >= 0) {
+        close(ring->fd);
+    }
+    free(ring->slot_pending);
+    free(ring);
+}
+
+int pbo_uring_init(struct pbo_uring **ring_ptr) {
+    int status;
+
+    unsigned depth = atomic_load_explicit(&pbo_uring_depth, memory_order_relaxed);
+    if(depth == 0) {
+        return ENOSYS;
+    }
+
+    struct pbo_uring *ring = calloc(1, sizeof(struct pbo_uring));
+    if(ring == NULL) {
+        return errno;
+    }
+    ring->depth = depth;
+
+    struct io_uring_params params = { 0 };
+    ring->fd = pbo_uring_setup(depth * PBO_URING_STEPS, &params);
+    if(ring->fd < 0) {
+        status = errno;
+        free(ring);
+        return status == EPERM || status == EINVAL ? ENOSYS : status;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring->cq_map_size > ring->sq_map_size) {
+            ring->sq_map_size = ring->cq_map_size;
+        }
+        ring->cq_map_size = ring->sq_map_size;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+    } else if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+    }
+
+    ring->slot_pending = calloc(depth, sizeof(unsigned));
+    int *slots = malloc(depth * sizeof(int));
+    if(ring->sq_map == NULL || ring->cq_map == NULL || ring->sqes == NULL || ring->slot_pending == NULL || slots == NULL) {
+        status = errno;
+        free(slots);
+        pbo_uring_destroy(ring);
+        return status;
+    }
+
+    char *sq = ring->sq_map, *cq = ring->cq_map;
+    ring->sq_head = (_Atomic unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (_Atomic unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->cq_head = (_Atomic unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (_Atomic unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    // an empty table that opens fill in
+    for(unsigned i = 0; i < depth; i++) {
+        slots[i] = -1;
+    }
+    status = 0;
+    if(!pbo_uring_supported(ring->fd) || pbo_uring_register(ring->fd, IORING_REGISTER_FILES, slots, depth) != 0) {
+        status = ENOSYS;
+    }
+    free(slots);
+    if(status != 0) {
+        pbo_uring_destroy(ring);
+        return status;
+    }
+
+    *ring_ptr = ring;
+    return 0;
+}
+
+static struct io_uring_sqe * pbo_uring_sqe(struct pbo_uring *ring, unsigned *tail, size_t op, unsigned step, uint8_t opcode, uint8_t flags) {
+    unsigned index = *tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    *sqe = (struct io_uring_sqe) {
+        .opcode = opcode,
+        .flags = flags,
+        .user_data = (uint64_t) op * PBO_URING_STEPS + step,
+    };
+    ring->sq_array[index] = index;
+    (*tail)++;
+    return sqe;
+}
+
+/*
+ * Queues the chain of one operation in a slot: an optional read into the
+ * buffer from another descriptor, then open, transfer and close.
+ */
+static unsigned pbo_uring_queue(struct pbo_uring *ring, unsigned *tail, struct pbo_uring_op *op, size_t index, unsigned slot) {
+    struct io_uring_sqe *sqe;
+    unsigned count = 0;
+    bool writing = (op->flags & O_ACCMODE) != O_RDONLY;
+
+    if(op->srcfd >= 0) {
+        sqe = pbo_uring_sqe(ring, tail, index, count++, IORING_OP_READ, IOSQE_IO_LINK);
+        sqe->fd = op->srcfd;
+        sqe->addr = (uintptr_t) op->buf;
+        sqe->len = op->len;
+        sqe->off = op->srcoff;
+    }
+
+    sqe = pbo_uring_sqe(ring, tail, index, count++, IORING_OP_OPENAT, IOSQE_IO_LINK);
+    sqe->fd = op->dirfd;
+    sqe->addr = (uintptr_t) op->path;
+    sqe->len = writing ? 00666 : 0;
+    sqe->open_flags = op->flags; // O_CLOEXEC is refused, the slot is not a descriptor
+    sqe->file_index = slot + 1;
+
+    sqe = pbo_uring_sqe(ring, tail, index, count++, writing ? IORING_OP_WRITE : IORING_OP_READ, IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK);
+    sqe->fd = slot;
+    sqe->addr = (uintptr_t) op->buf;
+    sqe->len = op->len;
+    sqe->off = 0;
+
+    sqe = pbo_uring_sqe(ring, tail, index, count++, IORING_OP_CLOSE, 0);
+    sqe->file_index = slot + 1;
+
+    return count;
+}
+
+static void pbo_uring_result(struct pbo_uring_op *op, unsigned step, int res) {
+    // the first failure of a chain is the one that counts, what follows it
+    // is cancelled
+    if(op->status != 0) {
+        return;
+    }
+
+    // steps numbered as if every chain started with a read from srcfd
+    step += op->srcfd >= 0 ? 0 : 1;
+    if(res < 0) {
+        op->status = -res;
+    } else if((step == 0 || step == 2) && (size_t) res != op->len) {
+        op->status = EIO; // short transfers break the chain too
+    }
+
+    if(res >= 0) {
+        switch(step) {
+            case 0:
+                pbo_count(PBO_COUNTER_READ, 1);
+                pbo_count(PBO_COUNTER_BYTES_READ, res);
+                break;
+            case 1:
+                pbo_count(PBO_COUNTER_OPEN, 1);
+                break;
+            case 2:
+                bool writing = (op->flags & O_ACCMODE) != O_RDONLY;
+                pbo_count(writing ? PBO_COUNTER_WRITE : PBO_COUNTER_READ, 1);
+                pbo_count(writing ? PBO_COUNTER_BYTES_WRITTEN : PBO_COUNTER_BYTES_READ, res);
+                break;
+        }
+    }
+}
+
+/*
+ * Takes back the requests the kernel has not consumed, which it never sees
+ * once the tail is rewound, and cancels the operations they belong to.
+ * Chains already partly submitted still complete what was submitted.
+ */
+static size_t pbo_uring_unqueue(struct pbo_uring *ring, struct pbo_uring_op *ops, unsigned *slot_free, unsigned *free_slots) {
+    size_t done = 0;
+    unsigned head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    for(; head != tail; head++) {
+        const struct io_uring_sqe *sqe = &ring->sqes[ring->sq_array[head & ring->sq_mask]];
+        struct pbo_uring_op *op = &ops[sqe->user_data / PBO_URING_STEPS];
+        if(op->status == 0) {
+            op->status = ECANCELED;
+        }
+        if(--ring->slot_pending[op->slot] == 0) {
+            slot_free[(*free_slots)++] = op->slot;
+            done++;
+        }
+    }
+    atomic_store_explicit(ring->sq_tail, atomic_load_explicit(ring->sq_head, memory_order_acquire), memory_order_release);
+    return done;
+}
+
+int pbo_uring_run(struct pbo_uring *ring, struct pbo_uring_op *ops, size_t count) {
+    int status = 0;
+    size_t next = 0, done = 0;
+    unsigned free_slots = ring->depth;
+    unsigned *slot_free = NULL;
+
+    for(size_t i = 0; i < count; i++) {
+        ops[i].status = 0;
+    }
+
+    slot_free = malloc(ring->depth * sizeof(unsigned));
+    if(slot_free == NULL) {
+        return errno;
+    }
+    for(unsigned i = 0; i < ring->depth; i++) {
+        slot_free[i] = ring->depth - 1 - i;
+    }
+
+    // after a failed submission nothing more is queued, but what the kernel
+    // took must complete before the buffers it uses are handed back
+    while(done < (status == 0 ? count : next)) {
+        // only this thread touches the submission queue
+        unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+        while(status == 0 && next < count && free_slots > 0) {
+            unsigned slot = slot_free[--free_slots];
+            ops[next].slot = slot;
+            ring->slot_pending[slot] = pbo_uring_queue(ring, &tail, &ops[next], next, slot);
+            next++;
+        }
+        atomic_store_explicit(ring->sq_tail, tail, memory_order_release);
+
+        // whatever an interrupted call left unsubmitted goes with the next
+        unsigned unsubmitted = tail - atomic_load_explicit(ring->sq_head, memory_order_acquire);
+        if(pbo_uring_enter(ring->fd, unsubmitted, 1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY && status == 0) {
+            status = errno;
+            done += pbo_uring_unqueue(ring, ops, slot_free, &free_slots);
+            continue;
+        }
+
+        unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+        unsigned cqtail = atomic_load_explicit(ring->cq_tail, memory_order_acquire);
+        for(; head != cqtail; head++) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+            size_t index = cqe->user_data / PBO_URING_STEPS;
+            unsigned step = cqe->user_data % PBO_URING_STEPS;
+            struct pbo_uring_op *op = &ops[index];
+
+            pbo_uring_result(op, step, cqe->res);
+            if(--ring->slot_pending[op->slot] == 0) {
+                slot_free[free_slots++] = op->slot;
+                done++;
+            }
+        }
+        atomic_store_explicit(ring->cq_head, head, memory_order_release);
+    }
+
+    for(size_t i = next; i < count; i++) {
+        ops[i].status = ECANCELED;
+    }
+
+    free(slot_free);
+    return status;
+}
+
+#else
+
+struct pbo_uring {
+    int unused;
+};
+
+int pbo_uring_init(struct pbo_uring **ring) {
+    (void) ring;
+    return ENOSYS;
+}
+
+int pbo_uring_run(struct pbo_uring *ring, struct pbo_uring_op *ops, size_t count) {
+    (void) ring, (void) ops, (void) count;
+    return ENOSYS;
+}
+
+void pbo_uring_destroy(struct pbo_uring *ring) {
+    (void) ring;
+}
+
+#endif
+
+int pbo_io_uring(unsigned depth) {
+    if(depth == 0) {
+        atomic_store_explicit(&pbo_uring_depth, 0, memory_order_relaxed);
+        return 0;
+    }
+
+    // make sure the kernel takes a ring before promising one
+    atomic_store_explicit(&pbo_uring_depth, depth, memory_order_relaxed);
+    struct pbo_uring *ring;
+    int status = pbo_uring_init(&ring);
+    if(status != 0) {
+        atomic_store_explicit(&pbo_uring_depth, 0, memory_order_relaxed);
+        return status;
+    }
+    pbo_uring_destroy(ring);
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pbofile.h"
+#include "../pbo.h"
+
+#define PBO_VERIFY_BUFFER (1 << 20)
+#define PBO_TRAILER_SIZE (1 + PBO_SHA1_SIZE)
+
+int pbo_verify(FILE *file) {
+    unsigned char *buf = malloc(PBO_TRAILER_SIZE + PBO_VERIFY_BUFFER);
+    if(buf == NULL) {
+        return errno;
+    }
+
+    struct pbo_sha1 sha;
+    pbo_sha1_init(&sha);
+
+    // the last bytes read are held back until they are known to be the trailer
+    size_t held = 0;
+    for(;;) {
+        size_t rlen = fread(buf + held, 1, PBO_VERIFY_BUFFER, file);
+        if(rlen == 0) {
+            break;
+        }
+        held += rlen;
+        pbo_count(PBO_COUNTER_READ, 1);
+        pbo_count(PBO_COUNTER_BYTES_READ, rlen);
+
+        if(held > PBO_TRAILER_SIZE) {
+            pbo_sha1_update(&sha, buf, held - PBO_TRAILER_SIZE);
+            memmove(buf, buf + held - PBO_TRAILER_SIZE, PBO_TRAILER_SIZE);
+            held = PBO_TRAILER_SIZE;
+        }
+    }
+
+    if(ferror(file)) {
+        free(buf);
+        return EIO;
+    }
+
+    int status = 0;
+    if(held < PBO_TRAILER_SIZE || buf[0] != '\0') {
+        status = EBADMSG;
+    } else {
+        unsigned char digest[PBO_SHA1_SIZE];
+        pbo_sha1_final(&sha, digest);
+        if(memcmp(digest, buf + 1, PBO_SHA1_SIZE) != 0) {
+            status = EBADMSG;
+        }
+    }
+
+    free(buf);
+    return status;
+}
+
+const char * pbo_verify_impl(void) {
+    return pbo_sha1_impl();
+}
@@ -14,4 +14,525 @@
  * limitations under the License.
  */
 
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "pbofile.h"
+
+/*
+ * Entry data is read by a separate thread into a ring of buffers while the
+ * saving thread hashes and writes the filled ones, so reading the inputs
+ * overlaps with writing the output. Consecutive small files share buffers.
+ * Runs of entries that are stored in a mapped PBO are handed over as ranges
+ * instead, hashed from the mapping and copied between the descriptors. With
+ * io_uring enabled, runs of whole source files are read in batches.
+ *
+ * The header goes through the stream. When the output is a regular file,
+ * everything after it is written with pwrite() at a tracked position, and
+ * the stream is moved past it at the end; other outputs are written through
+ * the stream throughout.
+ */
+
+#define PBO_SAVE_BUFFER_SIZE (1 << 20)
+#define PBO_SAVE_BUFFER_COUNT 4
+#define PBO_SAVE_BATCH 256
+
+struct pbo_save_buffer {
+    char *data;
+    size_t len;
+
+    const struct pbo *copy; // set for a range of a mapped PBO
+    const char *copy_data;
+};
+
+struct pbo_save_output {
+    FILE *file;
+    int fd; // -1 to write through the stream
+    off_t pos;
+};
+
+struct pbo_save_pipe {
+    struct pbo *pbo;
+
+    pthread_mutex_t lock;
+    pthread_cond_t filled, drained;
+
+    struct pbo_save_buffer buffers[PBO_SAVE_BUFFER_COUNT];
+    size_t head, tail; // buffers [tail, head) are filled
+    bool copy_ranges;
+    bool done, cancelled;
+    int status;
+};
+
+static int pbo_save_entry_read(struct pbo_entry *ent, int *fd, size_t *pos, char *buf, size_t len, size_t *rlen) {
+    if(ent->data != NULL) {
+        memcpy(buf, (const char *) ent->data + *pos, len);
+        *rlen = len;
+    } else if(ent->source != NULL) {
+        if(*fd < 0) {
+            pbo_count(PBO_COUNTER_OPEN, 1);
+            *fd = open(ent->source, O_RDONLY | O_CLOEXEC);
+            if(*fd < 0) {
+                return errno;
+            }
+        }
+
+        ssize_t status = read(*fd, buf, len);
+        if(status < 0) {
+            return errno;
+        } else if(status == 0) {
+            return EIO; // the source shrank since it was added
+        }
+        *rlen = status;
+        pbo_count(PBO_COUNTER_READ, 1);
+        pbo_count(PBO_COUNTER_BYTES_READ, status);
+    } else {
+        return ENODATA;
+    }
+
+    *pos += *rlen;
+    return 0;
+}
+
+/*
+ * Reads as many of the following source files as fit into the buffer whole
+ * through the ring. Stops at the first one that failed, which is then read
+ * the usual way to report why.
+ */
+static void pbo_save_batch(struct pbo_uring *ring, struct pbo_uring_op *ops, struct pbo_entry **ent, struct pbo_entry *end, struct pbo_save_buffer *buffer) {
+    size_t count = 0, len = buffer->len;
+    for(struct pbo_entry *next = *ent; next < end && count < PBO_SAVE_BATCH; next++, count++) {
+        if(next->data != NULL || next->origin != NULL || next->source == NULL || next->data_size > PBO_SAVE_BUFFER_SIZE - len) {
+            break;
+        }
+
+        ops[count] = (struct pbo_uring_op) {
+            .dirfd = AT_FDCWD,
+            .path = next->source,
+            .flags = O_RDONLY,
+            .buf = buffer->data + len,
+            .len = next->data_size,
+            .srcfd = -1,
+        };
+        len += next->data_size;
+    }
+
+    if(count == 0 || pbo_uring_run(ring, ops, count) != 0) {
+        return;
+    }
+
+    for(size_t i = 0; i < count && ops[i].status == 0; i++) {
+        buffer->len += ops[i].len;
+        (*ent)++;
+    }
+}
+
+static void * pbo_save_reader(void *arg) {
+    struct pbo_save_pipe *pipe = arg;
+    int status = 0;
+
+    struct pbo_entry *ent = pipe->pbo->entries, *end = pipe->pbo->entries + pipe->pbo->entry_count;
+    size_t pos = 0;
+    int fd = -1;
+
+    struct pbo_uring *ring = NULL;
+    struct pbo_uring_op *ops = NULL;
+    if(pbo_uring_init(&ring) == 0) {
+        ops = malloc(PBO_SAVE_BATCH * sizeof(struct pbo_uring_op));
+        if(ops == NULL) {
+            pbo_uring_destroy(ring);
+            ring = NULL;
+        }
+    }
+
+    while(ent < end && status == 0) {
+        pthread_mutex_lock(&pipe->lock);
+        while(pipe->head - pipe->tail == PBO_SAVE_BUFFER_COUNT && !pipe->cancelled) {
+            pthread_cond_wait(&pipe->drained, &pipe->lock);
+        }
+        bool cancelled = pipe->cancelled;
+        pthread_mutex_unlock(&pipe->lock);
+
+        if(cancelled) {
+            break;
+        }
+
+        struct pbo_save_buffer *buffer = &pipe->buffers[pipe->head % PBO_SAVE_BUFFER_COUNT];
+        buffer->len = 0;
+        buffer->copy = NULL;
+
+        if(pipe->copy_ranges && ent < end && ent->origin != NULL) {
+            buffer->copy = ent->origin;
+            buffer->copy_data = ent->data;
+            while(ent < end && ent->origin == buffer->copy && (const char *) ent->data == buffer->copy_data + buffer->len) {
+                buffer->len += ent->data_size;
+                ent++;
+            }
+        }
+
+        while(buffer->copy == NULL && ent < end && buffer->len < PBO_SAVE_BUFFER_SIZE) {
+            if(pipe->copy_ranges && ent->origin != NULL && pos == 0) {
+                break;
+            }
+
+            if(ring != NULL && pos == 0) {
+                struct pbo_entry *first = ent;
+                pbo_save_batch(ring, ops, &ent, end, buffer);
+                if(ent != first) {
+                    continue;
+                }
+            }
+
+            size_t want = ent->data_size - pos;
+            if(want > PBO_SAVE_BUFFER_SIZE - buffer->len) {
+                want = PBO_SAVE_BUFFER_SIZE - buffer->len;
+            }
+
+            size_t rlen = 0;
+            if(want > 0) {
+                status = pbo_save_entry_read(ent, &fd, &pos, buffer->data + buffer->len, want, &rlen);
+                if(status != 0) {
+                    break;
+                }
+            }
+            buffer->len += rlen;
+
+            if(pos == ent->data_size) {
+                if(fd >= 0) {
+                    close(fd);
+                    fd = -1;
+                }
+                pos = 0;
+                ent++;
+            }
+        }
+
+        pthread_mutex_lock(&pipe->lock);
+        if(status == 0) {
+            pipe->head++;
+        }
+        pthread_cond_signal(&pipe->filled);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+
+    if(fd >= 0) {
+        close(fd);
+    }
+    if(ring != NULL) {
+        pbo_uring_destroy(ring);
+        free(ops);
+    }
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->done = true;
+    pipe->status = status;
+    pthread_cond_signal(&pipe->filled);
+    pthread_mutex_unlock(&pipe->lock);
+    return NULL;
+}
+
+static int pbo_save_output_write(struct pbo_save_output *out, const void *data, size_t len) {
+    if(out->fd < 0) {
+        if(fwrite(data, 1, len, out->file) != len) {
+            return EIO;
+        }
+        pbo_count(PBO_COUNTER_BYTES_WRITTEN, len);
+        return 0;
+    }
+
+    for(size_t written = 0; written < len;) {
+        ssize_t wlen = pwrite(out->fd, (const char *) data + written, len - written, out->pos);
+        if(wlen < 0) {
+            return errno;
+        }
+        written += wlen;
+        out->pos += wlen;
+        pbo_count(PBO_COUNTER_WRITE, 1);
+        pbo_count(PBO_COUNTER_BYTES_WRITTEN, wlen);
+    }
+    return 0;
+}
+
+static int pbo_save_write(struct pbo_save_output *out, struct pbo_sha1 *sha, const void *data, size_t len) {
+    pbo_sha1_update(sha, data, len);
+    return pbo_save_output_write(out, data, len);
+}
+
+static int pbo_save_copy(struct pbo_save_output *out, struct pbo_sha1 *sha, const struct pbo_save_buffer *buffer) {
+    int status;
+
+    pbo_sha1_update(sha, buffer->copy_data, buffer->len);
+
+    off_t inpos = buffer->copy_data - (const char *) buffer->copy->map;
+    status = pbo_copy_range(buffer->copy->map_fd, inpos, out->fd, out->pos, buffer->len);
+    if(status != 0) {
+        return status;
+    }
+
+    out->pos += buffer->len;
+    return 0;
+}
+
+static int pbo_save_header_entry(struct pbo_save_output *out, struct pbo_sha1 *sha, const char *path, const char *mime, uint32_t original_size, uint32_t timestamp, uint32_t data_size) {
+    int status;
+
+    status = pbo_save_write(out, sha, path, strlen(path) + 1);
+    if(status != 0) {
+        return status;
+    }
+
+    uint32_t fields[5];
+    memcpy(&fields[0], mime, 4);
+    fields[1] = htole32(original_size);
+    fields[2] = 0;
+    fields[3] = htole32(timestamp);
+    fields[4] = htole32(data_size);
+    return pbo_save_write(out, sha, fields, sizeof(fields));
+}
+
+static int pbo_save_header(struct pbo *pbo, struct pbo_save_output *out, struct pbo_sha1 *sha) {
+    int status;
+
+    status = pbo_save_header_entry(out, sha, "", "sreV", 0, 0, 0);
+    if(status != 0) {
+        return status;
+    }
+
+    for(struct pbo_property *prop = pbo->properties; prop < pbo->properties + pbo->property_count; prop++) {
+        status = pbo_save_write(out, sha, prop->key, strlen(prop->key) + 1);
+        if(status != 0) {
+            return status;
+        }
+
+        status = pbo_save_write(out, sha, prop->value, strlen(prop->value) + 1);
+        if(status != 0) {
+            return status;
+        }
+    }
+
+    status = pbo_save_write(out, sha, "", 1);
+    if(status != 0) {
+        return status;
+    }
+
+    for(struct pbo_entry *ent = pbo->entries; ent < pbo->entries + pbo->entry_count; ent++) {
+        if(ent->data_size > UINT32_MAX || ent->original_size > UINT32_MAX || ent->timestamp < 0 || ent->timestamp > UINT32_MAX) {
+
+            return EOVERFLOW;
+        }
+
+        switch(ent->type) {
+            case PBO_ENTRY_NULL:
+                status = pbo_save_header_entry(out, sha, ent->path, "\0\0\0\0", 0, ent->timestamp, ent->data_size);
+                break;
+            case PBO_ENTRY_CPRS:
+                status = pbo_save_header_entry(out, sha, ent->path, "srpC", ent->original_size, ent->timestamp, ent->data_size);
+                break;
+            default:
+                return ENOTSUP;
+        }
+        if(status != 0) {
+            return status;
+        }
+    }
+
+    return pbo_save_header_entry(out, sha, "", "\0\0\0\0", 0, 0, 0);
+}
+
+static int pbo_save_data(struct pbo *pbo, struct pbo_save_output *out, struct pbo_sha1 *sha) {
+    int status;
+
+    // ranges can only be copied into a regular file at a known position
+    struct pbo_save_pipe pipe = {
+        .pbo = pbo,
+        .copy_ranges = out->fd >= 0,
+    };
+
+    for(size_t i = 0; i < PBO_SAVE_BUFFER_COUNT; i++) {
+        pipe.buffers[i].data = malloc(PBO_SAVE_BUFFER_SIZE);
+        if(pipe.buffers[i].data == NULL) {
+            status = errno;
+            for(size_t j = 0; j < i; j++) {
+                free(pipe.buffers[j].data);
+            }
+            return status;
+        }
+    }
+
+    pthread_mutex_init(&pipe.lock, NULL);
+    pthread_cond_init(&pipe.filled, NULL);
+    pthread_cond_init(&pipe.drained, NULL);
+
+    pthread_t reader;
+    status = pthread_create(&reader, NULL, pbo_save_reader, &pipe);
+    if(status != 0) {
+        pthread_cond_destroy(&pipe.drained);
+        pthread_cond_destroy(&pipe.filled);
+        pthread_mutex_destroy(&pipe.lock);
+        for(size_t i = 0; i < PBO_SAVE_BUFFER_COUNT; i++) {
+            free(pipe.buffers[i].data);
+        }
+        return status;
+    }
+
+    while(1) {
+        pthread_mutex_lock(&pipe.lock);
+        while(pipe.head == pipe.tail && !pipe.done) {
+            pthread_cond_wait(&pipe.filled, &pipe.lock);
+        }
+        bool empty = pipe.head == pipe.tail;
+        pthread_mutex_unlock(&pipe.lock);
+
+        if(empty) {
+            break;
+        }
+
+        struct pbo_save_buffer *buffer = &pipe.buffers[pipe.tail % PBO_SAVE_BUFFER_COUNT];
+        if(buffer->copy != NULL) {
+            status = pbo_save_copy(out, sha, buffer);
+        } else {
+            status = pbo_save_write(out, sha, buffer->data, buffer->len);
+        }
+
+        pthread_mutex_lock(&pipe.lock);
+        pipe.tail++;
+        if(status != 0) {
+            pipe.cancelled = true;
+        }
+        pthread_cond_signal(&pipe.drained);
+        pthread_mutex_unlock(&pipe.lock);
+
+        if(status != 0) {
+            break;
+        }
+    }
+
+    pthread_join(reader, NULL);
+    if(status == 0) {
+        status = pipe.status;
+    }
+
+    pthread_cond_destroy(&pipe.drained);
+    pthread_cond_destroy(&pipe.filled);
+    pthread_mutex_destroy(&pipe.lock);
+    for(size_t i = 0; i < PBO_SAVE_BUFFER_COUNT; i++) {
+        free(pipe.buffers[i].data);
+    }
+
+    return status;
+}
+
+int pbo_entry_compress(struct pbo_entry *ent, int level) {
+    int status;
+
+    if(ent->data != NULL) {
+        return 0;
+    } else if(ent->type != PBO_ENTRY_NULL || ent->source == NULL) {
+        return EINVAL;
+    }
+
+    size_t len = ent->data_size;
+    char *buf = malloc(len > 0 ? len : 1);
+    if(buf == NULL) {
+        return errno;
+    }
+
+    pbo_count(PBO_COUNTER_OPEN, 1);
+    int fd = open(ent->source, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        status = errno;
+        free(buf);
+        return status;
+    }
+
+    for(size_t total = 0; total < len;) {
+        ssize_t rlen = read(fd, buf + total, len - total);
+        if(rlen <= 0) {
+            status = rlen < 0 ? errno : EIO;
+            close(fd);
+            free(buf);
+            return status;
+        }
+        total += rlen;
+        pbo_count(PBO_COUNTER_READ, 1);
+        pbo_count(PBO_COUNTER_BYTES_READ, rlen);
+    }
+    close(fd);
+
+    void *packed;
+    size_t packedlen;
+    status = pbo_lzss_compress(buf, len, level, len > 0 ? len - 1 : 0, &packed, &packedlen);
+    free(buf);
+    if(status == ENOSPC) {
+        return 0; // stored as is
+    } else if(status != 0) {
+        return status;
+    }
+
+    ent->packed = packed;
+    ent->data = packed;
+    ent->type = PBO_ENTRY_CPRS;
+    ent->original_size = len;
+    ent->data_size = packedlen;
+    return 0;
+}
+
+int pbo_save(struct pbo *pbo, FILE *file) {
+    int status;
+
+    struct pbo_sha1 sha;
+    pbo_sha1_init(&sha);
+
+    struct pbo_save_output out = {
+        .file = file,
+        .fd = -1,
+    };
+
+    status = pbo_save_header(pbo, &out, &sha);
+    if(status != 0) {
+        return status;
+    }
+
+    if(fflush(file) != 0) {
+        return errno;
+    }
+
+    struct stat info;
+    pbo_count(PBO_COUNTER_STAT, 1);
+    if(fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode)) {
+        pbo_count(PBO_COUNTER_SEEK, 1);
+        out.pos = ftello(file);
+        out.fd = out.pos >= 0 ? fileno(file) : -1;
+    }
+
+    status = pbo_save_data(pbo, &out, &sha);
+    if(status != 0) {
+        return status;
+    }
+
+    unsigned char trailer[1 + PBO_SHA1_SIZE] = { 0 };
+    pbo_sha1_final(&sha, trailer + 1);
+    status = pbo_save_output_write(&out, trailer, sizeof(trailer));
+    if(status != 0) {
+        return status;
+    }
+
+    if(out.fd >= 0) {
+        pbo_count(PBO_COUNTER_SEEK, 1);
+        if(fseeko(file, out.pos, SEEK_SET) != 0) {
+            return errno;
+        }
+    }
+
+    if(fflush(file) != 0) {
+        return errno;
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+struct pool {
+    atomic_size_t next;
+    size_t count;
+
+    void (*fn)(void *arg, size_t index);
+    void *arg;
+};
+
+static void * pool_worker(void *arg) {
+    struct pool *pool = arg;
+
+    for(size_t i = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed); i < pool->count; i = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed)) {
+        pool->fn(pool->arg, i);
+    }
+
+    return NULL;
+}
+
+int pool_run(unsigned jobs, size_t count, void (*fn)(void *arg, size_t index), void *arg) {
+    int status;
+
+    struct pool pool = {
+        .next = 0,
+        .count = count,
+        .fn = fn,
+        .arg = arg,
+    };
+
+    size_t nthreads = jobs > count ? count : jobs;
+    if(nthreads <= 1) {
+        pool_worker(&pool);
+        return 0;
+    }
+
+    pthread_t *threads = calloc(nthreads - 1, sizeof(pthread_t));
+    if(threads == NULL) {
+        return errno;
+    }
+
+    size_t started;
+    for(started = 0; started < nthreads - 1; started++) {
+        status = pthread_create(&threads[started], NULL, pool_worker, &pool);
+        if(status != 0) {
+            break;
+        }
+    }
+
+    // the caller always takes part, so the work completes even if no thread started
+    pool_worker(&pool);
+
+    for(size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright 2025 Aleksa Radomirovic
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Calls fn(arg, i) for every i in [0, count), spread across up to `jobs`
+ * threads including the caller. Indices are handed out in increasing order
+ * as threads become free, so callers control scheduling by ordering their
+ * work items. Per-item results are left to fn.
+ */
+int pool_run(unsigned jobs, size_t count, void (*fn)(void *arg, size_t index), void *arg);